@@ -0,0 +1,386 @@
+#include "fastDetect.hpp"
+#include "convolve.hpp"
+#include "threadPool.hpp"
+#include "profiler.hpp"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FAST_X86 1
+#include <immintrin.h>
+#else
+#define FAST_X86 0
+#endif
+
+using namespace std;
+
+namespace shun {
+
+// radius of the circle, no corner is closer to the border
+static const int FastRadius = 3;
+
+// the Bresenham circle of radius 3, clockwise from the top
+static const int CircleX[16] = {0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3, -3, -3, -2, -1};
+static const int CircleY[16] = {-3, -3, -2, -1, 0, 1, 2, 3, 3, 3, 2, 1, 0, -1, -2, -3};
+
+FastWorkspace::FastWorkspace()
+{
+    Image *pImages[] = {&mConverted, &mGray, &mScore};
+    for (Image *pImage : pImages)
+        pImage->SetAllocator(&mPool);
+}
+
+// ppRows[dy + 3] is the row at offset dy from the current one
+static inline const unsigned char *CirclePixel(const unsigned char * const *ppRows, int x, int k)
+{
+    return ppRows[CircleY[k] + FastRadius] + x + CircleX[k];
+}
+
+// 1 if the 16-bit circle mask has arc contiguous set bits, wrapping around
+static inline bool HasArc(unsigned int mask, int arc)
+{
+    unsigned int ring = mask | (mask << 16);
+    unsigned int run = ring;
+    for (int k = 1; k < arc; ++k)
+        run &= ring >> k;
+    return (run & 0xFFFF) != 0;
+}
+
+// 1 if the compass bits 0, 4, 8 and 12 of mask have the neighbours an arc needs
+static inline bool CompassPasses(unsigned int mask, int arc)
+{
+    unsigned int compass = (mask & 1) | (mask >> 3 & 2) | (mask >> 6 & 4) | (mask >> 9 & 8);
+    unsigned int ring = compass | (compass << 4);
+    unsigned int run = ring & (ring >> 1);
+    if (arc >= 12)
+        run &= ring >> 2;
+    return (run & 15) != 0;
+}
+
+// Scalar reference of the segment test, appends the corner columns of [start, end) to columns.
+// The compass pixels 0, 4, 8 and 12 reject most pixels first: 9 contiguous pixels cover two
+// neighbouring ones of them, 12 cover three.
+static void SegmentTestScalar(const unsigned char * const *ppRows, int threshold, int arc, int start, int end,
+                              vector<int> &columns)
+{
+    const unsigned char *pCenter = ppRows[FastRadius];
+    for (int x = start; x < end; ++x) {
+        int high = pCenter[x] + threshold;
+        int low = pCenter[x] - threshold;
+        unsigned int bright = 0, dark = 0;
+        for (int k = 0; k < 16; k += 4) {
+            int p = *CirclePixel(ppRows, x, k);
+            bright |= (unsigned int)(p > high) << k;
+            dark |= (unsigned int)(p < low) << k;
+        }
+        if (!CompassPasses(bright, arc) && !CompassPasses(dark, arc))
+            continue;
+
+        for (int k = 0; k < 16; ++k) {
+            int p = *CirclePixel(ppRows, x, k);
+            bright |= (unsigned int)(p > high) << k;
+            dark |= (unsigned int)(p < low) << k;
+        }
+        if (HasArc(bright, arc) || HasArc(dark, arc))
+            columns.push_back(x);
+    }
+}
+
+#if FAST_X86
+
+// The vector tests compare 16 or 32 centers with their circles at once: bytes are offset by
+// 0x80 for the signed compare, the bounds saturate, so they decide exactly as the scalar test.
+// Runs are built by doubling, run2[k] = m[k] & m[k+1], run4[k] = run2[k] & run2[k+2] and so on.
+
+__attribute__((target("sse4.1")))
+static __m128i ArcSse41(const __m128i *pMask, int arc)
+{
+    __m128i run2[16], run4[16], any = _mm_setzero_si128();
+    for (int k = 0; k < 16; ++k)
+        run2[k] = _mm_and_si128(pMask[k], pMask[(k + 1) & 15]);
+    for (int k = 0; k < 16; ++k)
+        run4[k] = _mm_and_si128(run2[k], run2[(k + 2) & 15]);
+    for (int k = 0; k < 16; ++k) {
+        __m128i run8 = _mm_and_si128(run4[k], run4[(k + 4) & 15]);
+        __m128i tail = (arc >= 12) ? run4[(k + 8) & 15] : pMask[(k + 8) & 15];
+        any = _mm_or_si128(any, _mm_and_si128(run8, tail));
+    }
+    return any;
+}
+
+__attribute__((target("sse4.1")))
+static void SegmentTestSse41(const unsigned char * const *ppRows, int threshold, int arc, int start, int end,
+                             vector<int> &columns)
+{
+    const __m128i sign = _mm_set1_epi8((char)0x80);
+    const __m128i thd = _mm_set1_epi8((char)threshold);
+    int x = start;
+    for (; x + 16 <= end; x += 16) {
+        __m128i center = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ppRows[FastRadius] + x));
+        __m128i high = _mm_xor_si128(_mm_adds_epu8(center, thd), sign);
+        __m128i low = _mm_xor_si128(_mm_subs_epu8(center, thd), sign);
+
+        __m128i bright[16], dark[16];
+        for (int k = 0; k < 16; k += 4) {
+            __m128i p = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(CirclePixel(ppRows, x, k))), sign);
+            bright[k] = _mm_cmpgt_epi8(p, high);
+            dark[k] = _mm_cmplt_epi8(p, low);
+        }
+        __m128i b04 = _mm_and_si128(bright[0], bright[4]), b8c = _mm_and_si128(bright[8], bright[12]);
+        __m128i d04 = _mm_and_si128(dark[0], dark[4]), d8c = _mm_and_si128(dark[8], dark[12]);
+        __m128i candidate;
+        if (arc >= 12) {
+            candidate = _mm_or_si128(_mm_or_si128(_mm_and_si128(b04, _mm_or_si128(bright[8], bright[12])),
+                                                  _mm_and_si128(b8c, _mm_or_si128(bright[0], bright[4]))),
+                                     _mm_or_si128(_mm_and_si128(d04, _mm_or_si128(dark[8], dark[12])),
+                                                  _mm_and_si128(d8c, _mm_or_si128(dark[0], dark[4]))));
+        } else {
+            __m128i b48 = _mm_and_si128(bright[4], bright[8]), bc0 = _mm_and_si128(bright[12], bright[0]);
+            __m128i d48 = _mm_and_si128(dark[4], dark[8]), dc0 = _mm_and_si128(dark[12], dark[0]);
+            candidate = _mm_or_si128(_mm_or_si128(_mm_or_si128(b04, b8c), _mm_or_si128(b48, bc0)),
+                                     _mm_or_si128(_mm_or_si128(d04, d8c), _mm_or_si128(d48, dc0)));
+        }
+        if (_mm_testz_si128(candidate, candidate))
+            continue;
+
+        for (int k = 0; k < 16; ++k) {
+            if ((k & 3) == 0)
+                continue;
+            __m128i p = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(CirclePixel(ppRows, x, k))), sign);
+            bright[k] = _mm_cmpgt_epi8(p, high);
+            dark[k] = _mm_cmplt_epi8(p, low);
+        }
+        unsigned int hits = (unsigned int)_mm_movemask_epi8(_mm_or_si128(ArcSse41(bright, arc), ArcSse41(dark, arc)));
+        for (; hits != 0; hits &= hits - 1)
+            columns.push_back(x + __builtin_ctz(hits));
+    }
+    SegmentTestScalar(ppRows, threshold, arc, x, end, columns);
+}
+
+__attribute__((target("avx2")))
+static __m256i ArcAvx2(const __m256i *pMask, int arc)
+{
+    __m256i run2[16], run4[16], any = _mm256_setzero_si256();
+    for (int k = 0; k < 16; ++k)
+        run2[k] = _mm256_and_si256(pMask[k], pMask[(k + 1) & 15]);
+    for (int k = 0; k < 16; ++k)
+        run4[k] = _mm256_and_si256(run2[k], run2[(k + 2) & 15]);
+    for (int k = 0; k < 16; ++k) {
+        __m256i run8 = _mm256_and_si256(run4[k], run4[(k + 4) & 15]);
+        __m256i tail = (arc >= 12) ? run4[(k + 8) & 15] : pMask[(k + 8) & 15];
+        any = _mm256_or_si256(any, _mm256_and_si256(run8, tail));
+    }
+    return any;
+}
+
+// AVX2: 32 centers, there is no byte compare in avx512f, so the AVX-512 level runs this one
+__attribute__((target("avx2")))
+static void SegmentTestAvx2(const unsigned char * const *ppRows, int threshold, int arc, int start, int end,
+                            vector<int> &columns)
+{
+    const __m256i sign = _mm256_set1_epi8((char)0x80);
+    const __m256i thd = _mm256_set1_epi8((char)threshold);
+    int x = start;
+    for (; x + 32 <= end; x += 32) {
+        __m256i center = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ppRows[FastRadius] + x));
+        __m256i high = _mm256_xor_si256(_mm256_adds_epu8(center, thd), sign);
+        __m256i low = _mm256_xor_si256(_mm256_subs_epu8(center, thd), sign);
+
+        __m256i bright[16], dark[16];
+        for (int k = 0; k < 16; k += 4) {
+            __m256i p = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(CirclePixel(ppRows, x, k))), sign);
+            bright[k] = _mm256_cmpgt_epi8(p, high);
+            dark[k] = _mm256_cmpgt_epi8(low, p);
+        }
+        __m256i b04 = _mm256_and_si256(bright[0], bright[4]), b8c = _mm256_and_si256(bright[8], bright[12]);
+        __m256i d04 = _mm256_and_si256(dark[0], dark[4]), d8c = _mm256_and_si256(dark[8], dark[12]);
+        __m256i candidate;
+        if (arc >= 12) {
+            candidate = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(b04, _mm256_or_si256(bright[8], bright[12])),
+                                                        _mm256_and_si256(b8c, _mm256_or_si256(bright[0], bright[4]))),
+                                        _mm256_or_si256(_mm256_and_si256(d04, _mm256_or_si256(dark[8], dark[12])),
+                                                        _mm256_and_si256(d8c, _mm256_or_si256(dark[0], dark[4]))));
+        } else {
+            __m256i b48 = _mm256_and_si256(bright[4], bright[8]), bc0 = _mm256_and_si256(bright[12], bright[0]);
+            __m256i d48 = _mm256_and_si256(dark[4], dark[8]), dc0 = _mm256_and_si256(dark[12], dark[0]);
+            candidate = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(b04, b8c), _mm256_or_si256(b48, bc0)),
+                                        _mm256_or_si256(_mm256_or_si256(d04, d8c), _mm256_or_si256(d48, dc0)));
+        }
+        if (_mm256_testz_si256(candidate, candidate))
+            continue;
+
+        for (int k = 0; k < 16; ++k) {
+            if ((k & 3) == 0)
+                continue;
+            __m256i p = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(CirclePixel(ppRows, x, k))), sign);
+            bright[k] = _mm256_cmpgt_epi8(p, high);
+            dark[k] = _mm256_cmpgt_epi8(low, p);
+        }
+        unsigned int hits = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(ArcAvx2(bright, arc), ArcAvx2(dark, arc)));
+        for (; hits != 0; hits &= hits - 1)
+            columns.push_back(x + __builtin_ctz(hits));
+    }
+    _mm256_zeroupper();
+    SegmentTestScalar(ppRows, threshold, arc, x, end, columns);
+}
+
+#endif // FAST_X86
+
+static void SegmentTest(const unsigned char * const *ppRows, int threshold, int arc, int start, int end,
+                        vector<int> &columns)
+{
+    switch (GetSimdLevel())
+    {
+#if FAST_X86
+    case SimdLevel::AVX512:
+    case SimdLevel::AVX2:
+        SegmentTestAvx2(ppRows, threshold, arc, start, end, columns);
+        break;
+    case SimdLevel::SSE41:
+        SegmentTestSse41(ppRows, threshold, arc, start, end, columns);
+        break;
+#endif
+    case SimdLevel::SCALAR:
+    default:
+        SegmentTestScalar(ppRows, threshold, arc, start, end, columns);
+        break;
+    }
+}
+
+// the larger of the summed excesses of the brighter and of the darker circle pixels over the threshold
+static float Score(const unsigned char * const *ppRows, int x, int threshold)
+{
+    int center = ppRows[FastRadius][x];
+    int bright = 0, dark = 0;
+    for (int k = 0; k < 16; ++k) {
+        int diff = *CirclePixel(ppRows, x, k) - center;
+        if (diff > threshold)
+            bright += diff - threshold;
+        else if (diff < -threshold)
+            dark += -diff - threshold;
+    }
+    return (float)max(bright, dark);
+}
+
+CVError FastDetect::FindFeature(const Image &img, const FastParam &param, FastResult &result) const
+{
+    FastWorkspace workspace;
+    return FindFeature(img, param, result, workspace);
+}
+
+CVError FastDetect::FindFeature(const Image &img, const FastParam &param, FastResult &result, FastWorkspace &workspace) const
+{
+    CVError status = CVError::NOERROR;
+    ProfileScope scope("FastDetect");
+    result.Clear();
+
+    if (img.IsEmpty() || param.threshold < 1 || param.threshold > 255 || (param.arc != 9 && param.arc != 12)) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // extend a view by the parent's pixels the circles and the suppression of its corners reach
+    Image extended;
+    const Image *pGray = &img;
+    int left = 0, top = 0;
+    if (img.IsView()) {
+        int apron = FastRadius + ((param.nmsSize > 1) ? param.nmsSize / 2 : 0);
+        left = std::min(apron, img.GetMarginLeft());
+        top = std::min(apron, img.GetMarginTop());
+        int right = std::min(apron, img.GetMarginRight());
+        int bottom = std::min(apron, img.GetMarginBottom());
+        status = img.GetView(extended, -left, -top, img.GetWidth() + left + right, img.GetHeight() + top + bottom);
+        SHOW_ERROR_AND_RETURN(status);
+        pGray = &extended;
+    }
+
+    // 8-bit gray, an 8-bit gray input is searched in place
+    if (pGray->GetType() != ImageType::UINT8) {
+        float alpha = (pGray->GetType() == ImageType::UINT16) ? 1.0f / 257.0f : 1.0f;
+        status = pGray->ConvertTo(workspace.mConverted, ImageType::UINT8, alpha);
+        SHOW_ERROR_AND_RETURN(status);
+        pGray = &workspace.mConverted;
+    }
+    if (pGray->GetChannel() != 1) {
+        status = pGray->RGB2Gray(workspace.mGray);
+        SHOW_ERROR_AND_RETURN(status);
+        pGray = &workspace.mGray;
+    }
+
+    return Detect(*pGray, left, top, img.GetWidth(), img.GetHeight(), param, result, workspace);
+}
+
+CVError FastDetect::Detect(const Image &gray, int roiX, int roiY, int roiWidth, int roiHeight,
+                           const FastParam &param, FastResult &result, FastWorkspace &workspace) const
+{
+    CVError status = CVError::NOERROR;
+    ProfileScope stage("segment");
+
+    // the score image is only needed by the suppression, everything but the corners is 0
+    bool suppress = param.nmsSize > 1;
+    if (suppress) {
+        status = workspace.mScore.Allocate(gray.GetWidth(), gray.GetHeight(), 1, ImageType::FLOAT32);
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // the region and the apron whose scores its suppression sees, less the pixels whose circle
+    // leaves the image. Only the corners inside the region are kept.
+    int apron = suppress ? param.nmsSize / 2 : 0;
+    int x0 = max(roiX - apron, FastRadius), x1 = min(roiX + roiWidth + apron, gray.GetWidth() - FastRadius);
+    int y0 = max(roiY - apron, FastRadius), y1 = min(roiY + roiHeight + apron, gray.GetHeight() - FastRadius);
+
+    ThreadPool &pool = ThreadPool::Shared();
+    int bands = pool.GetBandCount(gray.GetHeight(), 32);
+    workspace.mBands.resize(bands);
+    workspace.mColumns.resize(bands);
+
+    pool.ParallelBands(bands, [&](int band) {
+        FastResult &corners = workspace.mBands[band];
+        vector<int> &columns = workspace.mColumns[band];
+        corners.Clear();
+        for (int y = gray.GetHeight() * band / bands; y < gray.GetHeight() * (band + 1) / bands; ++y) {
+            if (suppress)
+                memset(workspace.mScore.GetRow<float>(y), 0, gray.GetWidth() * sizeof(float));
+            if (y < y0 || y >= y1 || x0 >= x1)
+                continue;
+
+            const unsigned char *ppRows[2 * FastRadius + 1];
+            for (int k = 0; k <= 2 * FastRadius; ++k)
+                ppRows[k] = gray.GetRow<unsigned char>(y + k - FastRadius);
+            columns.clear();
+            SegmentTest(ppRows, param.threshold, param.arc, x0, x1, columns);
+
+            float *pScore = suppress ? workspace.mScore.GetRow<float>(y) : nullptr;
+            bool inside = y >= roiY && y < roiY + roiHeight;
+            for (int x : columns) {
+                float score = Score(ppRows, x, param.threshold);
+                if (inside && x >= roiX && x < roiX + roiWidth)
+                    corners.Add(x, y, score);
+                if (pScore)
+                    pScore[x] = score;
+            }
+        }
+    });
+
+    // the bands in order give the corners in raster order
+    for (const FastResult &corners : workspace.mBands) {
+        result.mX.insert(result.mX.end(), corners.mX.begin(), corners.mX.end());
+        result.mY.insert(result.mY.end(), corners.mY.begin(), corners.mY.end());
+        result.mResponse.insert(result.mResponse.end(), corners.mResponse.begin(), corners.mResponse.end());
+        result.mScale.insert(result.mScale.end(), corners.mScale.begin(), corners.mScale.end());
+    }
+
+    stage.Next("suppress");
+    if (suppress)
+        SuppressNonMax(workspace.mScore, param.nmsSize, result);
+    for (int i = 0; i < result.Size(); ++i) {
+        result.mX[i] -= roiX;
+        result.mY[i] -= roiY;
+    }
+    KeepPerCell(param.gridSize, param.gridCorners, result);
+    KeepStrongest(param.maxCorners, result);
+
+    return status;
+}
+
+}
@@ -0,0 +1,62 @@
+#ifndef __FASTDETECT_HPP__
+#define __FASTDETECT_HPP__
+
+#include "featureDetect.hpp"
+#include <vector>
+
+namespace shun {
+
+    struct FastParam {
+            FastParam(): threshold{20}, arc{9}, nmsSize{3}, maxCorners{0}, gridSize{0}, gridCorners{0} {}
+
+            int threshold;   // a circle pixel is brighter or darker than the center by more than this [1 - 255]
+            int arc;         // contiguous brighter or darker pixels of the 16-pixel circle, 9 or 12
+            int nmsSize;     // keep only the maxima of the score in nmsSize x nmsSize windows, 0 or 1: off
+            int maxCorners;  // keep the strongest corners sorted by decreasing score, 0: all in raster order
+            int gridSize;    // cell size of the spatial grid in pixels, 0: off
+            int gridCorners; // the most corners kept per grid cell
+    };
+
+    // the same struct of arrays as HarrisResult, mResponse holds the FAST score
+    typedef FeatureResult FastResult;
+
+    // The scratch of FindFeature kept between calls, used by one call at a time.
+    class FastWorkspace {
+        public:
+            FastWorkspace();
+            FastWorkspace(const FastWorkspace &rhs) = delete;
+            FastWorkspace& operator=(const FastWorkspace &rhs) = delete;
+            virtual ~FastWorkspace() {}
+
+            BufferPool mPool;   // first, so it outlives the images
+            Image mConverted;   // 8-bit copy of a UINT16 or FLOAT32 input
+            Image mGray;
+            Image mScore;
+            std::vector<FastResult> mBands;         // corners of every row band
+            std::vector<std::vector<int>> mColumns; // segment test hits of the current row of every band
+    };
+
+    // FAST corners [Rosten and Drummond 2006]: a pixel is a corner if arc contiguous pixels of the
+    // radius-3 Bresenham circle around it are all brighter than center + threshold or all darker than
+    // center - threshold. The segment test runs on 16 or 32 pixels at once and gives the same corners
+    // at every SIMD level. The score is the larger of the summed brighter and darker excesses over
+    // the threshold, the non-maximum suppression and the caps work on it as on the Harris response.
+    class FastDetect : public FeatureDetect {
+        public:
+            FastDetect(): FeatureDetect() {}
+            virtual ~FastDetect() {}
+            // img is converted to 8-bit gray, FLOAT32 is taken on the 0-255 scale. A view is searched
+            // together with the parent's pixels around it, as with HarrisDetect. No corner is found
+            // within 3 pixels of the border of the image or of the parent of a view.
+            CVError FindFeature(const Image &img, const FastParam &param, FastResult &result) const;
+            // the same, reusing the buffers of workspace
+            CVError FindFeature(const Image &img, const FastParam &param, FastResult &result, FastWorkspace &workspace) const;
+
+        protected:
+            CVError Detect(const Image &gray, int roiX, int roiY, int roiWidth, int roiHeight,
+                           const FastParam &param, FastResult &result, FastWorkspace &workspace) const;
+    };
+
+}
+
+#endif // __FASTDETECT_HPP__
@@ -0,0 +1,116 @@
+#include "featureDetect.hpp"
+#include <algorithm>
+
+using namespace std;
+
+namespace shun {
+
+void FeatureDetect::SuppressNonMax(const Image &response, int size, FeatureResult &result)
+{
+    if (size <= 1)
+        return;
+
+    int radius = size / 2;
+    int width = response.GetWidth();
+    int height = response.GetHeight();
+    vector<int> keep;
+    keep.reserve(result.Size());
+
+    for (int i = 0; i < result.Size(); ++i) {
+        int x = result.mX[i];
+        int y = result.mY[i];
+        float value = response.GetRow<float>(y)[x];
+        int x0 = max(x - radius, 0), x1 = min(x + radius, width - 1);
+        int y0 = max(y - radius, 0), y1 = min(y + radius, height - 1);
+        bool isMax = true;
+
+        for (int v = y0; v <= y1 && isMax; ++v) {
+            const float *pRow = response.GetRow<float>(v);
+            for (int u = x0; u <= x1; ++u) {
+                // a neighbor before (x, y) in raster order wins a tie
+                bool before = (v < y) || (v == y && u < x);
+                if (pRow[u] > value || (before && pRow[u] == value)) {
+                    isMax = false;
+                    break;
+                }
+            }
+        }
+        if (isMax)
+            keep.push_back(i);
+    }
+
+    Select(keep, result);
+}
+
+void FeatureDetect::KeepPerCell(int cellSize, int cellCorners, FeatureResult &result)
+{
+    if (cellSize <= 0 || cellCorners <= 0)
+        return;
+
+    int columns = 0;
+    for (int i = 0; i < result.Size(); ++i)
+        columns = max(columns, result.mX[i] / cellSize + 1);
+
+    // by cell, then by decreasing response, then in the original order
+    vector<int> order(result.Size());
+    vector<long long> cell(result.Size());
+    for (int i = 0; i < result.Size(); ++i) {
+        order[i] = i;
+        cell[i] = (long long)(result.mY[i] / cellSize) * columns + result.mX[i] / cellSize;
+    }
+    sort(order.begin(), order.end(), [&](int a, int b) {
+        if (cell[a] != cell[b])
+            return cell[a] < cell[b];
+        if (result.mResponse[a] != result.mResponse[b])
+            return result.mResponse[a] > result.mResponse[b];
+        return a < b;
+    });
+
+    vector<int> keep;
+    for (int i = 0, count = 0; i < (int)order.size(); ++i) {
+        count = (i > 0 && cell[order[i]] == cell[order[i-1]]) ? count + 1 : 0;
+        if (count < cellCorners)
+            keep.push_back(order[i]);
+    }
+    // back to the original order
+    sort(keep.begin(), keep.end());
+
+    Select(keep, result);
+}
+
+void FeatureDetect::KeepStrongest(int maxCorners, FeatureResult &result)
+{
+    if (maxCorners <= 0)
+        return;
+
+    vector<int> order(result.Size());
+    for (int i = 0; i < result.Size(); ++i)
+        order[i] = i;
+
+    auto stronger = [&](int a, int b) {
+        if (result.mResponse[a] != result.mResponse[b])
+            return result.mResponse[a] > result.mResponse[b];
+        return a < b;
+    };
+    if (maxCorners < (int)order.size()) {
+        nth_element(order.begin(), order.begin() + maxCorners, order.end(), stronger);
+        order.resize(maxCorners);
+    }
+    sort(order.begin(), order.end(), stronger);
+
+    Select(order, result);
+}
+
+void FeatureDetect::Select(const vector<int> &order, FeatureResult &result)
+{
+    FeatureResult selected;
+    selected.mX.reserve(order.size());
+    selected.mY.reserve(order.size());
+    selected.mResponse.reserve(order.size());
+    selected.mScale.reserve(order.size());
+    for (int i : order)
+        selected.Add(result.mX[i], result.mY[i], result.mResponse[i], result.mScale[i]);
+    result = move(selected);
+}
+
+}
@@ -2,10 +2,29 @@
 #define __FEATUREDETECT_HPP__
 
 #include <string>
+#include <vector>
 #include "image.hpp"
 
 namespace shun {
 
+    // detected corners as a struct of arrays, the i-th corner is (mX[i], mY[i])
+    struct FeatureResult {
+            int Size() const { return (int)mX.size(); }
+            void Clear() { mX.clear(); mY.clear(); mResponse.clear(); mScale.clear(); }
+            void Add(int x, int y, float response, int scale = 1)
+            {
+                mX.push_back(x);
+                mY.push_back(y);
+                mResponse.push_back(response);
+                mScale.push_back(scale);
+            }
+
+            std::vector<int> mX;
+            std::vector<int> mY;
+            std::vector<float> mResponse;   // the detector's raw response at the corner
+            std::vector<int> mScale;        // pyramid scale the corner was found at, 1: full resolution
+    };
+
     class FeatureDetect {
         public:
             FeatureDetect(): mDebug{0}, mDebugPath{"./"} {}
@@ -13,8 +32,19 @@ namespace shun {
 
             int mDebug;
             std::string mDebugPath;
+
+        protected:
+            // keep the corners whose response is the maximum of the size x size window around them,
+            // equal responses are resolved in raster order so a plateau keeps one corner
+            static void SuppressNonMax(const Image &response, int size, FeatureResult &result);
+            // keep at most cellCorners of the strongest corners in every cellSize x cellSize cell
+            static void KeepPerCell(int cellSize, int cellCorners, FeatureResult &result);
+            // keep the maxCorners strongest corners, sorted by decreasing response
+            static void KeepStrongest(int maxCorners, FeatureResult &result);
+            // keep the corners listed in order
+            static void Select(const std::vector<int> &order, FeatureResult &result);
     };
 
 }
 
-#endif // __FEATUREDETECT_HPP__
\ No newline at end of file
+#endif // __FEATUREDETECT_HPP__
@@ -0,0 +1,118 @@
+#include "harrisBatch.hpp"
+#include "boundedQueue.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+using namespace std;
+
+namespace shun {
+
+typedef chrono::steady_clock BatchClock;
+
+static double Seconds(BatchClock::time_point begin)
+{
+    return chrono::duration<double>(BatchClock::now() - begin).count();
+}
+
+// an image travelling between two stages
+struct BatchJob {
+    int mIndex;
+    BatchClock::time_point mStart;  // the decode began
+    Image mImage;
+};
+
+// starts count threads running func and closes queue after the last of them returns
+template <typename F, typename Q>
+static void StartStage(vector<thread> &threads, int count, Q &queue, F func)
+{
+    auto running = make_shared<atomic<int>>(count);
+    for (int i = 0; i < count; ++i) {
+        threads.emplace_back([running, &queue, func] {
+            func();
+            if (--(*running) == 0)
+                queue.Close();
+        });
+    }
+}
+
+CVError HarrisBatch::Run(const vector<string> &inputs, const vector<string> &outputs,
+                         const HarrisParam &param, vector<HarrisBatchResult> &results) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (!outputs.empty() && outputs.size() != inputs.size()) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    results.assign(inputs.size(), HarrisBatchResult());
+    if (inputs.empty())
+        return status;
+
+    // decoded frames are recycled, so a batch of one size settles on queue-sized memory
+    BufferPool pool;
+    BoundedQueue<BatchJob> detectQueue(mQueueSize);
+    BoundedQueue<BatchJob> encodeQueue(mQueueSize);
+    atomic<int> next(0);
+    vector<thread> threads;
+
+    // decode, inputs are taken in order so the queues stay close to input order
+    StartStage(threads, max(mDecodeThreads, 1), detectQueue, [&] {
+        for (int i = next++; i < (int)inputs.size(); i = next++) {
+            BatchJob job;
+            job.mIndex = i;
+            job.mStart = BatchClock::now();
+            job.mImage.SetAllocator(&pool);
+            results[i].mStatus = job.mImage.ReadJpegImage(inputs[i].c_str(), mReadParam);
+            if (results[i].mStatus != CVError::NOERROR) {
+                results[i].mLatency = Seconds(job.mStart);
+                continue;
+            }
+            results[i].mWidth = job.mImage.GetWidth();
+            results[i].mHeight = job.mImage.GetHeight();
+            detectQueue.Push(move(job));
+        }
+    });
+
+    // detect, every thread keeps its own workspace
+    StartStage(threads, max(mDetectThreads, 1), encodeQueue, [&] {
+        HarrisWorkspace workspace;
+        BatchJob job;
+        while (detectQueue.Pop(job)) {
+            HarrisBatchResult &result = results[job.mIndex];
+            BatchClock::time_point begin = BatchClock::now();
+            result.mStatus = mDetect.FindFeature(job.mImage, param, result.mResult, workspace);
+            result.mDetectTime = Seconds(begin);
+            result.mLatency = Seconds(job.mStart);
+            if (result.mStatus == CVError::NOERROR && !outputs.empty() && !outputs[job.mIndex].empty())
+                encodeQueue.Push(move(job));
+            job.mImage.Release();
+        }
+    });
+
+    // annotate and encode
+    for (int i = 0; i < max(mEncodeThreads, 1); ++i) {
+        threads.emplace_back([&] {
+            BatchJob job;
+            while (encodeQueue.Pop(job)) {
+                HarrisBatchResult &result = results[job.mIndex];
+                const HarrisResult &corners = result.mResult;
+                for (int k = 0; k < corners.Size(); ++k)
+                    job.mImage.DrawPoint(corners.mX[k], corners.mY[k], 255.0f, 0.0f, 0.0f, mPointSize);
+                result.mStatus = job.mImage.WriteJpegImage(outputs[job.mIndex].c_str(), mWriteParam);
+                result.mLatency = Seconds(job.mStart);
+                job.mImage.Release();
+            }
+        });
+    }
+
+    for (auto &worker : threads)
+        worker.join();
+
+    return status;
+}
+
+}
@@ -0,0 +1,49 @@
+#ifndef __HARRISBATCH_HPP__
+#define __HARRISBATCH_HPP__
+
+#include "harrisDetect.hpp"
+#include <string>
+#include <vector>
+
+namespace shun {
+
+    // the outcome for one input of a batch
+    struct HarrisBatchResult {
+            HarrisBatchResult(): mStatus{CVError::NOERROR}, mWidth{0}, mHeight{0}, mLatency{0.0}, mDetectTime{0.0} {}
+
+            CVError mStatus;    // the first error of the decode, detect or encode stage
+            int mWidth;
+            int mHeight;
+            double mLatency;    // seconds from the start of the decode to the end of the last stage, queue waits included
+            double mDetectTime; // seconds in FindFeature
+            HarrisResult mResult;
+    };
+
+    // Runs decode, detection and the optional annotated encode of a list of JPEG files
+    // as concurrent stages connected by bounded queues, so file I/O and decoding of the
+    // next images overlap the detection of the current one. Every stage has its own
+    // threads, the detection itself still splits its rows over the shared ThreadPool.
+    class HarrisBatch {
+        public:
+            HarrisBatch(): mDecodeThreads{1}, mDetectThreads{1}, mEncodeThreads{1}, mQueueSize{4}, mPointSize{5} {}
+            virtual ~HarrisBatch() {}
+
+            // results[i] belongs to inputs[i]. outputs is empty or as long as inputs, an empty
+            // name skips the encode of that image. Fails only on bad arguments, the errors of
+            // single images are in their results.
+            CVError Run(const std::vector<std::string> &inputs, const std::vector<std::string> &outputs,
+                        const HarrisParam &param, std::vector<HarrisBatchResult> &results) const;
+
+            int mDecodeThreads;
+            int mDetectThreads;
+            int mEncodeThreads;
+            int mQueueSize;     // images waiting between two stages
+            int mPointSize;     // size of the corner marks drawn on the outputs
+            HarrisDetect mDetect;
+            JpegReadParam mReadParam;
+            JpegWriteParam mWriteParam;
+    };
+
+}
+
+#endif // __HARRISBATCH_HPP__
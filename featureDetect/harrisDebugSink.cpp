@@ -0,0 +1,160 @@
+#include "harrisDebugSink.hpp"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace shun {
+
+HarrisDebugSink::HarrisDebugSink(const string &path, int queueSize, int sampleEvery, DropPolicy policy):
+    mPath{path}, mSampleEvery{max(sampleEvery, 1)}, mPolicy{policy}, mCalls{0}, mFrames{0},
+    mPending{0}, mWritten{0}, mDropped{0}, mQueue{(size_t)max(queueSize, 1)}, mWriter{&HarrisDebugSink::Run, this}
+{
+}
+
+HarrisDebugSink::~HarrisDebugSink()
+{
+    mQueue.Close();
+    mWriter.join();
+}
+
+bool HarrisDebugSink::Sample()
+{
+    return (mCalls++ % mSampleEvery) == 0;
+}
+
+void HarrisDebugSink::Acquire(HarrisDebugDump &dump)
+{
+    lock_guard<mutex> lock(mMutex);
+    if (!mFree.empty()) {
+        dump = move(mFree.back());
+        mFree.pop_back();
+    }
+    dump.mFrame = mFrames++;
+}
+
+void HarrisDebugSink::Submit(HarrisDebugDump &&dump)
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        ++mPending;
+    }
+
+    bool queued;
+    switch (mPolicy)
+    {
+    case DropPolicy::BLOCK:
+        queued = mQueue.Push(move(dump));
+        break;
+    case DropPolicy::DROP_OLDEST:
+        // a failed TryPush leaves dump untouched, the evicted dump is dropped in its place
+        while (!(queued = mQueue.TryPush(move(dump)))) {
+            HarrisDebugDump oldest;
+            if (!mQueue.TryPop(oldest))
+                break;
+            Recycle(move(oldest));
+            Done(false);
+        }
+        break;
+    case DropPolicy::DROP_NEWEST:
+    default:
+        queued = mQueue.TryPush(move(dump));
+        break;
+    }
+
+    if (!queued) {
+        Recycle(move(dump));
+        Done(false);
+    }
+}
+
+void HarrisDebugSink::Flush()
+{
+    unique_lock<mutex> lock(mMutex);
+    mIdle.wait(lock, [this] { return mPending == 0; });
+}
+
+size_t HarrisDebugSink::GetWrittenCount() const
+{
+    lock_guard<mutex> lock(mMutex);
+    return mWritten;
+}
+
+size_t HarrisDebugSink::GetDroppedCount() const
+{
+    lock_guard<mutex> lock(mMutex);
+    return mDropped;
+}
+
+void HarrisDebugSink::Recycle(HarrisDebugDump &&dump)
+{
+    // as many as can be in flight at once, the rest are freed
+    lock_guard<mutex> lock(mMutex);
+    if (mFree.size() < mPending + 1)
+        mFree.push_back(move(dump));
+}
+
+void HarrisDebugSink::Done(bool written)
+{
+    lock_guard<mutex> lock(mMutex);
+    if (written)
+        ++mWritten;
+    else
+        ++mDropped;
+    if (--mPending == 0)
+        mIdle.notify_all();
+}
+
+void HarrisDebugSink::Run()
+{
+    HarrisDebugDump dump;
+    Image roiResp, normalResp;
+    while (mQueue.Pop(dump)) {
+        string prefix = mPath + "harris_" + to_string(dump.mFrame) + "_";
+        bool written = CVError::NOERROR == dump.mResponse.GetView(roiResp, dump.mRoiX, dump.mRoiY, dump.mRoiWidth, dump.mRoiHeight) &&
+                       CVError::NOERROR == roiResp.Normalize(normalResp, 0.0f, 255.0f) &&
+                       CVError::NOERROR == Write(prefix, dump.mGray, dump.mSobelX, dump.mSobelY, normalResp);
+        Recycle(move(dump));
+        Done(written);
+    }
+}
+
+CVError HarrisDebugSink::Write(const string &prefix, const Image &gray, Image &sobelX, Image &sobelY, const Image &normalResp)
+{
+    CVError status = CVError::NOERROR;
+
+    // save the gray image
+    string fileName = prefix + "gray.jpg";
+    status = gray.WriteJpegImage(fileName.c_str());
+    SHOW_ERROR_AND_RETURN(status);
+
+    // save sobel images
+    Image normalSX, normalSY;
+    for (int y = 0; y < sobelX.GetHeight(); ++y) {
+        float *pDx = sobelX.GetRow<float>(y);
+        float *pDy = sobelY.GetRow<float>(y);
+        for (int x = 0; x < sobelX.GetWidth(); ++x) {
+            pDx[x] = fabs(pDx[x]);
+            pDy[x] = fabs(pDy[x]);
+        }
+    }
+    status = sobelX.Normalize(normalSX, 0, 255);
+    SHOW_ERROR_AND_RETURN(status);
+    status = sobelY.Normalize(normalSY, 0, 255);
+    SHOW_ERROR_AND_RETURN(status);
+    fileName = prefix + "sobelX.jpg";
+    status = normalSX.WriteJpegImage(fileName.c_str());
+    SHOW_ERROR_AND_RETURN(status);
+    fileName = prefix + "sobelY.jpg";
+    status = normalSY.WriteJpegImage(fileName.c_str());
+    SHOW_ERROR_AND_RETURN(status);
+
+    // save the response image
+    fileName = prefix + "response.jpg";
+    status = normalResp.WriteJpegImage(fileName.c_str());
+    SHOW_ERROR_AND_RETURN(status);
+
+    return status;
+}
+
+}
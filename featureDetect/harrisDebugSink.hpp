@@ -0,0 +1,89 @@
+#ifndef __HARRISDEBUGSINK_HPP__
+#define __HARRISDEBUGSINK_HPP__
+
+#include "boundedQueue.hpp"
+#include "image.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace shun {
+
+    // the intermediates of one FindFeature call, their buffers move to the writer without a copy
+    struct HarrisDebugDump {
+            HarrisDebugDump(): mFrame{0}, mRoiX{0}, mRoiY{0}, mRoiWidth{0}, mRoiHeight{0} {}
+
+            int mFrame;         // sampled call number, part of the file names
+            int mRoiX;          // the searched region of mResponse, its whole area for a full image
+            int mRoiY;
+            int mRoiWidth;
+            int mRoiHeight;
+            Image mGray;
+            Image mSobelX;
+            Image mSobelY;
+            Image mResponse;    // raw Harris response
+    };
+
+    // what Submit() does when the queue is full
+    enum class DropPolicy : int {
+        DROP_NEWEST = 0,    // drop the submitted dump, the detection never waits
+        DROP_OLDEST,        // drop the oldest queued dump to make room
+        BLOCK,              // wait for the writer
+    };
+
+    // Writes the debug images of HarrisDetect on a background thread. FindFeature hands a
+    // sampled call's intermediates over through a bounded queue and returns, the writer
+    // normalizes and JPEG-encodes them into <path>harris_<frame>_{gray,sobelX,sobelY,response}.jpg.
+    // The dumps' buffers are recycled, so a steady stream of one frame size allocates nothing.
+    class HarrisDebugSink {
+        public:
+            // a dump is taken from every sampleEvery-th FindFeature call, one per level of a pyramid call
+            explicit HarrisDebugSink(const std::string &path, int queueSize = 4, int sampleEvery = 1,
+                                     DropPolicy policy = DropPolicy::DROP_NEWEST);
+            HarrisDebugSink(const HarrisDebugSink &rhs) = delete;
+            HarrisDebugSink& operator=(const HarrisDebugSink &rhs) = delete;
+            // writes what is queued, then stops the writer
+            virtual ~HarrisDebugSink();
+
+            // true if this call is sampled, counts the calls
+            bool Sample();
+            // dump gets recycled images to compute the intermediates into
+            void Acquire(HarrisDebugDump &dump);
+            void Submit(HarrisDebugDump &&dump);
+            // waits until every submitted dump is written or dropped
+            void Flush();
+
+            size_t GetWrittenCount() const;
+            size_t GetDroppedCount() const;
+
+            // the images of one dump named <prefix>{gray,sobelX,sobelY,response}.jpg, the Sobel
+            // images are overwritten with their absolute values
+            static CVError Write(const std::string &prefix, const Image &gray, Image &sobelX, Image &sobelY,
+                                 const Image &normalResp);
+
+        protected:
+            void Run();
+            void Recycle(HarrisDebugDump &&dump);
+            void Done(bool written);
+
+            std::string mPath;
+            int mSampleEvery;
+            DropPolicy mPolicy;
+            std::atomic<int> mCalls;
+            int mFrames;            // sampled calls, guarded by mMutex
+            size_t mPending;        // submitted and not yet written or dropped
+            size_t mWritten;
+            size_t mDropped;
+            std::vector<HarrisDebugDump> mFree;
+            BoundedQueue<HarrisDebugDump> mQueue;
+            mutable std::mutex mMutex;
+            std::condition_variable mIdle;
+            std::thread mWriter;    // last, it starts once the members above exist
+    };
+
+}
+
+#endif // __HARRISDEBUGSINK_HPP__
@@ -1,78 +1,230 @@
 #include "harrisDetect.hpp"
+#include "threadPool.hpp"
+#include "profiler.hpp"
 #include <iostream>
 #include <cmath>
+#include <algorithm>
 
 using namespace std;
 
 namespace shun {
 
+HarrisWorkspace::HarrisWorkspace()
+{
+    Image *pImages[] = {&mGray, &mSobelX, &mSobelY, &mCov, &mGaussian, &mResponse};
+    for (Image *pImage : pImages)
+        pImage->SetAllocator(&mPool);
+}
+
 CVError HarrisDetect::FindFeature(const Image &img, const HarrisParam &param, HarrisResult &result) const
+{
+    HarrisWorkspace workspace;
+    return FindFeature(img, param, result, workspace);
+}
+
+// pixels around a region that its responses and their non-maximum suppression depend on
+static int Apron(const HarrisParam &param)
+{
+    int radius;
+    switch (param.blurMode)
+    {
+    case BlurMode::BOX:
+        radius = BoxRadius(param.sigma);
+        break;
+    case BlurMode::RECURSIVE:
+        // the IIR response never ends, twice the Gaussian's radius leaves a negligible tail
+        radius = 2 * ((int)ceil(6 * param.sigma) / 2);
+        break;
+    case BlurMode::GAUSSIAN:
+    default:
+        radius = (int)ceil(6 * param.sigma) / 2;
+        break;
+    }
+
+    // + 1 for the Sobel
+    return radius + 1 + ((param.nmsSize > 1) ? param.nmsSize / 2 : 0);
+}
+
+bool HarrisDetect::SampleDebug() const
+{
+    return mDebug && (mpDebugSink == nullptr || mpDebugSink->Sample());
+}
+
+CVError HarrisDetect::FindFeature(const Image &img, const HarrisParam &param, HarrisResult &result, HarrisWorkspace &workspace) const
+{
+    return FindInImage(img, param, result, workspace, SampleDebug());
+}
+
+CVError HarrisDetect::FindInImage(const Image &img, const HarrisParam &param, HarrisResult &result,
+                                  HarrisWorkspace &workspace, bool dump) const
 {
     CVError status = CVError::NOERROR;
-    result.mCoord.clear();
+    ProfileScope scope("FindFeature");
+    result.Clear();
 
     if (img.IsEmpty()) {
         status = CVError::INPUT;
         SHOW_ERROR_AND_RETURN(status);
     }
 
-    Image grayImg;
-    status = img.RGB2Gray(grayImg);
-    SHOW_ERROR_AND_RETURN(status);
+    if (!img.IsView())
+        return Detect(img, 0, 0, img.GetWidth(), img.GetHeight(), param, result, workspace, dump);
 
-    Image sobelX, sobelY;
-    status = grayImg.Sobel(sobelX, sobelY);
+    // extend the view by the parent's pixels the corners inside it depend on, as far as there are any
+    int apron = Apron(param);
+    int left = std::min(apron, img.GetMarginLeft());
+    int top = std::min(apron, img.GetMarginTop());
+    int right = std::min(apron, img.GetMarginRight());
+    int bottom = std::min(apron, img.GetMarginBottom());
+    Image extended;
+    status = img.GetView(extended, -left, -top, img.GetWidth() + left + right, img.GetHeight() + top + bottom);
     SHOW_ERROR_AND_RETURN(status);
 
-    float dx, dy;
-    Image cov;
-    status = cov.Allocate(grayImg.GetWidth(), grayImg.GetHeight(), 3);
-    SHOW_ERROR_AND_RETURN(status);
-    for (int y = 0; y < grayImg.GetHeight(); ++y) {
-        for (int x = 0; x < grayImg.GetWidth(); ++x) {
-            dx = sobelX.GetPixel(x, y, 0);
-            dy = sobelY.GetPixel(x, y, 0);
-            cov.SetPixel(x, y, 0, dx*dx);
-            cov.SetPixel(x, y, 1, dx*dy);
-            cov.SetPixel(x, y, 2, dy*dy);
-        }
-    }
+    return Detect(extended, left, top, img.GetWidth(), img.GetHeight(), param, result, workspace, dump);
+}
 
-    Image gaussian;
-    status = cov.GaussianBlur(gaussian, param.sigma);
-    SHOW_ERROR_AND_RETURN(status);    
+CVError HarrisDetect::Detect(const Image &img, int roiX, int roiY, int roiWidth, int roiHeight,
+                             const HarrisParam &param, HarrisResult &result, HarrisWorkspace &workspace, bool dump) const
+{
+    CVError status = CVError::NOERROR;
+    result.Clear();
 
-    float h11, h12, h22, trace, det, R;
-    Image response;
-    status = response.Allocate(grayImg.GetWidth(), grayImg.GetHeight(), 1);
-    SHOW_ERROR_AND_RETURN(status);
-    for (int y = 0; y < response.GetHeight(); ++y) {
-        for (int x = 0; x < response.GetWidth(); ++x) {
-            // harris's response function
-            h11 = gaussian.GetPixel(x, y, 0);
-            h12 = gaussian.GetPixel(x, y, 1);
-            h22 = gaussian.GetPixel(x, y, 2);
-            det = h11 * h22 - h12 * h12;
-            trace = h11 + h22;
-            R = det - param.k * trace * trace;
-            response.SetPixel(x, y, 0, R);
-        }
+    // a sampled call of an asynchronous dump computes its intermediates straight into the dump,
+    // whose buffers are then moved to the writer, the other calls take the fast path
+    HarrisDebugDump debugDump;
+    bool async = dump && mpDebugSink != nullptr;
+    if (async)
+        mpDebugSink->Acquire(debugDump);
+
+    Image &grayImg = async ? debugDump.mGray : workspace.mGray;
+    Image &sobelX = async ? debugDump.mSobelX : workspace.mSobelX;
+    Image &sobelY = async ? debugDump.mSobelY : workspace.mSobelY;
+    Image &cov = workspace.mCov;
+    Image &gaussian = workspace.mGaussian;
+    Image &response = async ? debugDump.mResponse : workspace.mResponse;
+    float R;
+    bool fused = mFused && !dump && param.blurMode == BlurMode::GAUSSIAN;
+    // one scope per stage. The fused pipeline interleaves gray to response in one scope and
+    // records the events of its stages inside it.
+    ProfileScope stage(fused ? "pipeline" : "gray");
+
+    if (fused) {
+        // strip by strip, the debug dump and the IIR and box blurs need the full-frame intermediates below
+        HarrisPipeline &pipeline = workspace.mPipeline;
+        pipeline.mStripBytes = mStripBytes;
+        pipeline.mFixedPoint = param.fixedPoint;
+        status = pipeline.Run(img, param.sigma, param.k, response);
+        SHOW_ERROR_AND_RETURN(status);
+    } else {
+        status = img.RGB2Gray(grayImg);
+        SHOW_ERROR_AND_RETURN(status);
+
+        stage.Next("sobel");
+        status = grayImg.Sobel(sobelX, sobelY);
+        SHOW_ERROR_AND_RETURN(status);
+
+        stage.Next("tensor");
+        // planar, so the blur runs three contiguous 1-channel passes
+        status = cov.AllocatePlanar(grayImg.GetWidth(), grayImg.GetHeight(), 3);
+        SHOW_ERROR_AND_RETURN(status);
+        const Image &dxImg = sobelX, &dyImg = sobelY;
+        ThreadPool::Shared().ParallelFor(0, grayImg.GetHeight(), 16, [&](int begin, int end) {
+            float dx, dy;
+            for (int y = begin; y < end; ++y) {
+                const float *pDx = dxImg.GetRow<float>(y);
+                const float *pDy = dyImg.GetRow<float>(y);
+                float *pXX = cov.GetRow<float>(y);
+                float *pXY = pXX + cov.GetPlaneStride();
+                float *pYY = pXY + cov.GetPlaneStride();
+                for (int x = 0; x < grayImg.GetWidth(); ++x) {
+                    dx = pDx[x];
+                    dy = pDy[x];
+                    pXX[x] = dx*dx;
+                    pXY[x] = dx*dy;
+                    pYY[x] = dy*dy;
+                }
+            }
+        });
+
+        stage.Next("blur");
+        status = cov.Smooth(gaussian, param.sigma, param.blurMode);
+        SHOW_ERROR_AND_RETURN(status);    
+
+        stage.Next("response");
+        status = response.Allocate(grayImg.GetWidth(), grayImg.GetHeight(), 1);
+        SHOW_ERROR_AND_RETURN(status);
+        const Image &blurred = gaussian;
+        ThreadPool::Shared().ParallelFor(0, response.GetHeight(), 16, [&](int begin, int end) {
+            float h11, h12, h22, trace, det;
+            for (int y = begin; y < end; ++y) {
+                const float *pXX = blurred.GetRow<float>(y);
+                const float *pXY = pXX + blurred.GetPlaneStride();
+                const float *pYY = pXY + blurred.GetPlaneStride();
+                float *pResp = response.GetRow<float>(y);
+                for (int x = 0; x < response.GetWidth(); ++x) {
+                    // harris's response function
+                    h11 = pXX[x];
+                    h12 = pXY[x];
+                    h22 = pYY[x];
+                    det = h11 * h22 - h12 * h12;
+                    trace = h11 + h22;
+                    pResp[x] = det - param.k * trace * trace;
+                }
+            }
+        });
     }
 
-    Image normalResp;
-    status = response.Normalize(normalResp, 0.0f, 255.0f);
+    // only the region is thresholded, the response around it is still seen by the suppression.
+    // thd is on the 0-255 scale of the region's response range, it is mapped back to raw units
+    // instead of normalizing the response. A flat response has no corners. rawThd skips the range.
+    stage.Next("threshold");
+    Image roiResp;
+    status = response.GetView(roiResp, roiX, roiY, roiWidth, roiHeight);
     SHOW_ERROR_AND_RETURN(status);
-    for (int y = 0; y < normalResp.GetHeight(); ++y) {
-        for (int x = 0; x < normalResp.GetWidth(); ++x) {
-            R = normalResp.GetPixel(x, y, 0);
-            if (R > param.thd) {
-                result.mCoord.push_back(make_pair(x, y));
+    float rawThd = param.rawThd;
+    bool flat = false;
+    if (rawThd <= 0.0f) {
+        vector<float> minResp, maxResp;
+        status = roiResp.MinMax(minResp, maxResp);
+        SHOW_ERROR_AND_RETURN(status);
+        float range = maxResp[0] - minResp[0];
+        flat = !(range > 0.0f);
+        rawThd = minResp[0] + param.thd / 255.0f * range;
+    }
+    if (!flat) {
+        for (int y = 0; y < roiResp.GetHeight(); ++y) {
+            const float *pResp = roiResp.GetRow<float>(y);
+            for (int x = 0; x < roiResp.GetWidth(); ++x) {
+                R = pResp[x];
+                if (R > rawThd) {
+                    result.Add(x + roiX, y + roiY, R);
+                }
             }
         }
     }
 
-    if (mDebug)
-    {
+    // thin the candidates: local maxima, then a cap per grid cell, then the strongest overall
+    stage.Next("suppress");
+    SuppressNonMax(response, param.nmsSize, result);
+    for (int i = 0; i < result.Size(); ++i) {
+        result.mX[i] -= roiX;
+        result.mY[i] -= roiY;
+    }
+    KeepPerCell(param.gridSize, param.gridCorners, result);
+    KeepStrongest(param.maxCorners, result);
+
+    if (async) {
+        stage.Next("debug");
+        debugDump.mRoiX = roiX;
+        debugDump.mRoiY = roiY;
+        debugDump.mRoiWidth = roiWidth;
+        debugDump.mRoiHeight = roiHeight;
+        mpDebugSink->Submit(std::move(debugDump));
+    } else if (dump) {
+        stage.Next("debug");
+        Image normalResp;
+        status = roiResp.Normalize(normalResp, 0.0f, 255.0f);
+        SHOW_ERROR_AND_RETURN(status);
         // choose a corner coordinate to see how to work out
         #if (0)
         {
@@ -108,39 +260,51 @@ CVError HarrisDetect::FindFeature(const Image &img, const HarrisParam &param, Ha
         }
         #endif
 
-        // save the gray image
-        string fileName = mDebugPath;
-        fileName += "harris_gray.jpg";
-        grayImg.WriteJpegImage(fileName.c_str());
-
-        // save sobel images
-        Image normalSX, normalSY;
-        for (int y = 0; y < sobelX.GetHeight(); ++y) {
-            for (int x = 0; x < sobelX.GetWidth(); ++x) {
-                dx = sobelX.GetPixel(x, y, 0);
-                dy = sobelY.GetPixel(x, y, 0);
-                sobelX.SetPixel(x, y, 0, fabs(dx));
-                sobelY.SetPixel(x, y, 0, fabs(dy));
-            }
-        }
-        status = sobelX.Normalize(normalSX, 0, 255);
-        SHOW_ERROR_AND_RETURN(status);
-        status = sobelY.Normalize(normalSY, 0, 255);
+        status = HarrisDebugSink::Write(mDebugPath + "harris_", grayImg, sobelX, sobelY, normalResp);
         SHOW_ERROR_AND_RETURN(status);
-        fileName = mDebugPath;
-        fileName += "harris_sobelX.jpg";
-        normalSX.WriteJpegImage(fileName.c_str());
-        fileName = mDebugPath;
-        fileName += "harris_sobelY.jpg";
-        normalSY.WriteJpegImage(fileName.c_str());
-
-        // save the response image
-        fileName = mDebugPath;
-        fileName += "harris_response.jpg";
-        normalResp.WriteJpegImage(fileName.c_str());
     }
 
     return CVError::NOERROR;
 }
 
-}
\ No newline at end of file
+CVError HarrisDetect::FindFeature(const Pyramid &pyramid, const HarrisParam &param, HarrisResult &result) const
+{
+    HarrisWorkspace workspace;
+    return FindFeature(pyramid, param, result, workspace);
+}
+
+CVError HarrisDetect::FindFeature(const Pyramid &pyramid, const HarrisParam &param, HarrisResult &result, HarrisWorkspace &workspace) const
+{
+    CVError status = CVError::NOERROR;
+    ProfileScope scope("FindFeature(pyramid)");
+    result.Clear();
+
+    if (pyramid.GetLevelCount() == 0) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // the caps are applied once all levels are merged
+    HarrisParam levelParam = param;
+    levelParam.gridSize = 0;
+    levelParam.maxCorners = 0;
+
+    // one sampling decision for the whole call, a sampled call dumps every level
+    bool dump = SampleDebug();
+    HarrisResult &levelResult = workspace.mLevelResult;
+    for (int level = 0; level < pyramid.GetLevelCount(); ++level) {
+        status = FindInImage(pyramid.GetLevel(level), levelParam, levelResult, workspace, dump);
+        SHOW_ERROR_AND_RETURN(status);
+
+        int scale = pyramid.GetScale(level);
+        for (int i = 0; i < levelResult.Size(); ++i)
+            result.Add(levelResult.mX[i] * scale, levelResult.mY[i] * scale, levelResult.mResponse[i], scale);
+    }
+
+    KeepPerCell(param.gridSize, param.gridCorners, result);
+    KeepStrongest(param.maxCorners, result);
+
+    return status;
+}
+
+}
@@ -2,28 +2,87 @@
 #define __HARRISDETECT_HPP__
 
 #include "featureDetect.hpp"
-#include <vector>
-#include <utility>
+#include "harrisDebugSink.hpp"
+#include "harrisPipeline.hpp"
+#include "pyramid.hpp"
 
 namespace shun {
 
     struct HarrisParam {
-            HarrisParam(): sigma{2.0f}, k{0.04f}, thd{200} {}
+            HarrisParam(): sigma{2.0f}, k{0.04f}, thd{200}, nmsSize{0}, maxCorners{0}, gridSize{0}, gridCorners{0},
+                           blurMode{BlurMode::GAUSSIAN}, fixedPoint{0}, rawThd{0.0f} {}
 
-            float sigma; // a variance for Gaussion blur
-            float k;     // a const for Harris's response function [0.04 ~ 0.06]
-            int thd;     // a threshold for normalized Harris's response function [0 - 255]
+            float sigma;     // a variance for Gaussion blur
+            float k;         // a const for Harris's response function [0.04 ~ 0.06]
+            int thd;         // a threshold for normalized Harris's response function [0 - 255]
+            int nmsSize;     // keep only the maxima of nmsSize x nmsSize windows, 0 or 1: off
+            int maxCorners;  // keep the strongest corners sorted by decreasing response, 0: all in raster order
+            int gridSize;    // cell size of the spatial grid in pixels, 0: off
+            int gridCorners; // the most corners kept per grid cell
+            BlurMode blurMode;  // smoothing of the structure tensor, RECURSIVE and BOX cost the same for any sigma
+            int fixedPoint;  // 1: UINT8 input on the fused GAUSSIAN path runs in int16/int32 fixed point
+            float rawThd;    // > 0: threshold on the raw response instead of thd, the same for every image
     };
 
-    struct HarrisResult {
-            std::vector<std::pair<int, int>> mCoord;
+    typedef FeatureResult HarrisResult;
+
+    // The scratch images of FindFeature kept between calls. All of them draw from
+    // mPool, so once a frame size has been seen detection allocates no image buffers.
+    // A workspace is used by one FindFeature call at a time.
+    class HarrisWorkspace {
+        public:
+            HarrisWorkspace();
+            HarrisWorkspace(const HarrisWorkspace &rhs) = delete;
+            HarrisWorkspace& operator=(const HarrisWorkspace &rhs) = delete;
+            virtual ~HarrisWorkspace() {}
+
+            BufferPool mPool;   // first, so it outlives the images
+            Image mGray;
+            Image mSobelX;
+            Image mSobelY;
+            Image mCov;
+            Image mGaussian;
+            Image mResponse;
+            HarrisPipeline mPipeline;
+            HarrisResult mLevelResult;  // corners of one pyramid level
     };
 
     class HarrisDetect : public FeatureDetect {
         public:
-            HarrisDetect(): FeatureDetect() {}
+            HarrisDetect(): FeatureDetect(), mFused{1}, mStripBytes{512 * 1024}, mpDebugSink{nullptr} {}
             virtual ~HarrisDetect() {}
+            // img may be a view, see Image::GetView(). It is searched together with the parent's pixels
+            // around it, so inside it the responses and the local maxima equal those of the parent, and the
+            // corners are returned in view coordinates. thd is relative to the response range of the view and
+            // the grid starts at its origin. This is exact with GAUSSIAN; the running sums of RECURSIVE and BOX
+            // start at the view's apron, so their responses differ in rounding and near-ties may resolve differently.
             CVError FindFeature(const Image &img, const HarrisParam &param, HarrisResult &result) const;
+            // the same, reusing the buffers of workspace
+            CVError FindFeature(const Image &img, const HarrisParam &param, HarrisResult &result, HarrisWorkspace &workspace) const;
+            // multi-scale: every level of pyramid is searched with param, sigma in pixels of the level.
+            // The corners are returned in level 0 coordinates with the scale of their level in mScale.
+            // nmsSize and thd apply per level, gridSize and maxCorners to the merged corners.
+            CVError FindFeature(const Pyramid &pyramid, const HarrisParam &param, HarrisResult &result) const;
+            CVError FindFeature(const Pyramid &pyramid, const HarrisParam &param, HarrisResult &result, HarrisWorkspace &workspace) const;
+
+            int mFused;         // 1: fused strip pipeline, 0: full-frame intermediates (always used with mDebug
+                                // and with a blurMode other than GAUSSIAN)
+            int mStripBytes;    // working set budget of one strip of the fused pipeline
+            // with mDebug, nullptr: the debug images are written into mDebugPath before FindFeature returns,
+            // otherwise the sampled calls hand them to this sink, which must outlive the calls
+            HarrisDebugSink *mpDebugSink;
+
+        protected:
+            // whether a public FindFeature call dumps its debug images, asked once per call so
+            // that mpDebugSink counts calls and not pyramid levels
+            bool SampleDebug() const;
+            // FindFeature() of one image with the sampling decided by the caller
+            CVError FindInImage(const Image &img, const HarrisParam &param, HarrisResult &result,
+                                HarrisWorkspace &workspace, bool dump) const;
+            // corners of the roiWidth x roiHeight region at (roiX, roiY) of img, the rest of img only feeds
+            // the filters and the non-maximum suppression. dump: write the debug images of this call.
+            CVError Detect(const Image &img, int roiX, int roiY, int roiWidth, int roiHeight,
+                           const HarrisParam &param, HarrisResult &result, HarrisWorkspace &workspace, bool dump) const;
     };
 
 }
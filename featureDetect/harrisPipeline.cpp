@@ -0,0 +1,363 @@
+#include "harrisPipeline.hpp"
+#include "convolve.hpp"
+#include "profiler.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+
+using namespace std;
+
+namespace shun {
+
+// row y of a 3-channel image, interleaved or planar, to gray
+template <typename T>
+static void GrayRow(const Image &img, int y, T *pDst)
+{
+    const T *pSrc = img.GetRow<T>(y);
+    size_t plane = img.GetPlaneStride();
+    if (img.IsPlanar())
+        RGB2GrayRow(pSrc, pSrc + plane, pSrc + 2*plane, pDst, img.GetWidth());
+    else
+        RGB2GrayRow(pSrc, pDst, img.GetWidth());
+}
+
+CVError HarrisPipeline::Run(const Image &img, float sigma, float k, Image &response)
+{
+    CVError status = CVError::NOERROR;
+
+    if (img.IsEmpty() || (img.GetChannel() != 1 && img.GetChannel() != 3)) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // the image buffers each stage allocates, the kernel is the blur's and the response the last stage's
+    long long bytes[STAGE_COUNT] = {0};
+    bytes[STAGE_BLUR] = Profiler::GetAllocatedBytes();
+    Image kernel;
+    kernel.SetAllocator(response.GetAllocator());
+    status = GaussianKernel(kernel, mSize, mCenter, sigma);
+    SHOW_ERROR_AND_RETURN(status);
+    bytes[STAGE_BLUR] = Profiler::GetAllocatedBytes() - bytes[STAGE_BLUR];
+    mKernel.assign(kernel.GetData<float>(), kernel.GetData<float>() + mSize);
+    mFixedKernel.resize(mSize);
+    QuantizeKernel(mKernel.data(), mSize, mFixedKernel.data());
+    bool fixedPoint = mFixedPoint && img.GetType() == ImageType::UINT8;
+
+    bytes[STAGE_RESPONSE] = Profiler::GetAllocatedBytes();
+    status = response.Allocate(img.GetWidth(), img.GetHeight(), 1, ImageType::FLOAT32);
+    SHOW_ERROR_AND_RETURN(status);
+    bytes[STAGE_RESPONSE] = Profiler::GetAllocatedBytes() - bytes[STAGE_RESPONSE];
+
+    // a band recomputes 2*center+2 rows of apron, keep that small against its height
+    ThreadPool &pool = ThreadPool::Shared();
+    int height = img.GetHeight();
+    int bands = pool.GetBandCount(height, max(32, 8*(2*mCenter+2)));
+    mScratch.resize(bands);
+    bool profile = Profiler::IsEnabled();
+    long long start = profile ? Profiler::Now() : 0;
+
+    pool.ParallelBands(bands, [&](int band) {
+        int rowBegin = height * band / bands;
+        int rowEnd = height * (band + 1) / bands;
+        fill(mScratch[band].stageTime, mScratch[band].stageTime + STAGE_COUNT, 0LL);
+        if (fixedPoint) {
+            RunRowsFixed(img, k, response, rowBegin, rowEnd, mScratch[band]);
+            return;
+        }
+        switch (img.GetType())
+        {
+        case ImageType::UINT8:
+            RunRows<unsigned char>(img, k, response, rowBegin, rowEnd, mScratch[band]);
+            break;
+        case ImageType::UINT16:
+            RunRows<unsigned short>(img, k, response, rowBegin, rowEnd, mScratch[band]);
+            break;
+        case ImageType::FLOAT32:
+        default:
+            RunRows<float>(img, k, response, rowBegin, rowEnd, mScratch[band]);
+            break;
+        }
+    });
+
+    if (profile)
+        RecordStages(bands, start, Profiler::Now() - start, bytes);
+
+    return status;
+}
+
+// one event per stage on the calling thread, back to back over the wall time of the bands
+void HarrisPipeline::RecordStages(int bands, long long start, long long duration, const long long *pBytes) const
+{
+    static const char *names[STAGE_COUNT] = {"gray", "sobel", "tensor", "blur", "response"};
+
+    long long time[STAGE_COUNT] = {0};
+    long long total = 0;
+    for (int band = 0; band < bands; ++band) {
+        for (int stage = 0; stage < STAGE_COUNT; ++stage)
+            time[stage] += mScratch[band].stageTime[stage];
+    }
+    for (int stage = 0; stage < STAGE_COUNT; ++stage)
+        total += time[stage];
+
+    int thread = Profiler::GetThreadId();
+    for (int stage = 0; stage < STAGE_COUNT; ++stage) {
+        long long share = (total > 0) ? (long long)((double)duration * time[stage] / total) : 0;
+        ProfileEvent event = {names[stage], thread, start, share, pBytes[stage]};
+        Profiler::Shared().Record(event);
+        start += share;
+    }
+}
+
+// Output rows [rowBegin, rowEnd) are produced in strips. For a strip [r0, r1) the
+// vertical blur needs the tensor rows [r0-center, r1-1+center], and the Sobel of
+// those needs one more gray row above and below. Both rings hold the rows of one
+// strip plus the apron, so every row is computed exactly once.
+template <typename T>
+void HarrisPipeline::RunRows(const Image &img, float k, Image &response, int rowBegin, int rowEnd, Scratch &scratch)
+{
+    int width = img.GetWidth();
+    int height = img.GetHeight();
+    int channel = img.GetChannel();
+    int size = mSize;
+    int center = mCenter;
+    const float *pKernel = mKernel.data();
+
+    size_t rowBytes = (size_t)width * (3*sizeof(float) + (channel == 3 ? sizeof(T) : 0));
+    int stripRows = (int)(mStripBytes / rowBytes) - 2*center;
+    stripRows = min(max(stripRows, 1), rowEnd - rowBegin);
+    int capacity = stripRows + 2*center + 2;
+
+    if (channel == 3)
+        scratch.grayRing.resize((size_t)capacity * width * sizeof(T));
+    scratch.blurRing.resize((size_t)capacity * 3 * width);
+
+    // the lines of TensorRow(), then the blurred tensor
+    size_t tensorLines = TensorLineFloats(width, center);
+    scratch.lines.resize(tensorLines + 3*width);
+    float *pBlur = scratch.lines.data() + tensorLines;
+
+    T *pGrayRing = reinterpret_cast<T*>(scratch.grayRing.data());
+    float *pBlurRing = scratch.blurRing.data();
+    auto grayRow = [&](int y) -> const T* {
+        return (channel == 3) ? pGrayRing + (size_t)(y % capacity) * width : img.GetRow<T>(y);
+    };
+    auto blurRow = [&](int y) -> float* {
+        return pBlurRing + (size_t)(y % capacity) * 3 * width;
+    };
+
+    vector<const float*> rows(size);
+    int grayNext = max(rowBegin - center - 1, 0);
+    int blurNext = max(rowBegin - center, 0);
+    long long *pStageTime = Profiler::IsEnabled() ? scratch.stageTime : nullptr;
+
+    for (int r0 = rowBegin; r0 < rowEnd; r0 += stripRows) {
+        int r1 = min(r0 + stripRows, rowEnd);
+        int blurLast = min(r1 - 1 + center, height - 1);
+        int grayLast = min(blurLast + 1, height - 1);
+
+        // gray, a 1-channel input is used in place
+        if (channel == 3) {
+            long long t0 = pStageTime ? Profiler::Now() : 0;
+            for (; grayNext <= grayLast; ++grayNext)
+                GrayRow(img, grayNext, pGrayRing + (size_t)(grayNext % capacity) * width);
+            if (pStageTime)
+                pStageTime[STAGE_GRAY] += Profiler::Now() - t0;
+        }
+
+        // Sobel, structure tensor and horizontal blur
+        for (; blurNext <= blurLast; ++blurNext) {
+            int y = blurNext;
+            const T *ppGray[3] = {
+                grayRow(y > 0 ? y-1 : 0),
+                grayRow(y),
+                grayRow(y < height-1 ? y+1 : height-1),
+            };
+            TensorRow(ppGray, width, pKernel, size, center, scratch.lines.data(), blurRow(y), pStageTime);
+        }
+
+        // vertical blur and harris's response function
+        for (int y = r0; y < r1; ++y) {
+            for (int i = 0; i < size; ++i)
+                rows[i] = blurRow(min(max(y+i-center, 0), height-1));
+            ResponseRow(rows.data(), width, pKernel, size, k, pBlur, response.GetRow<float>(y), pStageTime);
+        }
+    }
+}
+
+template <typename T>
+void HarrisPipeline::TensorRow(const T * const *ppGray, int width, const float *pKernel, int size, int center,
+                               float *pLines, float *pDst, long long *pStageTime)
+{
+    // Sobel lines padded by 1 pixel, gradients, tensor line padded by the radius
+    float *pFx = pLines + 1;
+    float *pFy = pFx + width + 2;
+    float *pDx = pFy + width + 1;
+    float *pDy = pDx + width;
+    float *pTensor = pDy + width + 3*center;
+    float dx, dy;
+    long long t0 = pStageTime ? Profiler::Now() : 0;
+
+    ConvolveColumns<SobelSmooth>(ppGray, pFx, width);
+    ConvolveColumns<CentralDifference>(ppGray, pFy, width);
+    ReplicateRowEdges(pFx, width, 1, 1);
+    ReplicateRowEdges(pFy, width, 1, 1);
+    ConvolveRow<CentralDifference>(pFx, 1, pDx, width);
+    ConvolveRow<SobelSmooth>(pFy, 1, pDy, width);
+    long long t1 = pStageTime ? Profiler::Now() : 0;
+
+    for (int x = 0; x < width; ++x) {
+        dx = pDx[x];
+        dy = pDy[x];
+        pTensor[3*x+0] = dx*dx;
+        pTensor[3*x+1] = dx*dy;
+        pTensor[3*x+2] = dy*dy;
+    }
+    ReplicateRowEdges(pTensor, width, 3, center);
+    long long t2 = pStageTime ? Profiler::Now() : 0;
+    ConvolveRow(pTensor, 3, pKernel, size, center, pDst, 3*width);
+
+    if (pStageTime) {
+        pStageTime[STAGE_SOBEL] += t1 - t0;
+        pStageTime[STAGE_TENSOR] += t2 - t1;
+        pStageTime[STAGE_BLUR] += Profiler::Now() - t2;
+    }
+}
+
+template void HarrisPipeline::TensorRow(const unsigned char * const *, int, const float *, int, int, float *, float *, long long *);
+template void HarrisPipeline::TensorRow(const unsigned short * const *, int, const float *, int, int, float *, float *, long long *);
+template void HarrisPipeline::TensorRow(const float * const *, int, const float *, int, int, float *, float *, long long *);
+
+void HarrisPipeline::ResponseRow(const float * const *ppRows, int width, const float *pKernel, int size, float k,
+                                 float *pBlur, float *pResp, long long *pStageTime)
+{
+    float h11, h12, h22, trace, det;
+
+    long long t0 = pStageTime ? Profiler::Now() : 0;
+    ConvolveColumns(ppRows, pKernel, size, pBlur, 3*width);
+    long long t1 = pStageTime ? Profiler::Now() : 0;
+    for (int x = 0; x < width; ++x) {
+        h11 = pBlur[3*x+0];
+        h12 = pBlur[3*x+1];
+        h22 = pBlur[3*x+2];
+        det = h11 * h22 - h12 * h12;
+        trace = h11 + h22;
+        pResp[x] = det - k * trace * trace;
+    }
+    if (pStageTime) {
+        pStageTime[STAGE_BLUR] += t1 - t0;
+        pStageTime[STAGE_RESPONSE] += Profiler::Now() - t1;
+    }
+}
+
+// RunRows() in integers for UINT8 input, the tensor planes are blurred one by one
+void HarrisPipeline::RunRowsFixed(const Image &img, float k, Image &response, int rowBegin, int rowEnd, Scratch &scratch)
+{
+    int width = img.GetWidth();
+    int height = img.GetHeight();
+    int channel = img.GetChannel();
+    int size = mSize;
+    int center = mCenter;
+    int shift = FixedKernelShift;
+    const int *pKernel = mFixedKernel.data();
+
+    size_t rowBytes = (size_t)width * (3*sizeof(int) + (channel == 3 ? 1 : 0));
+    int stripRows = (int)(mStripBytes / rowBytes) - 2*center;
+    stripRows = min(max(stripRows, 1), rowEnd - rowBegin);
+    int capacity = stripRows + 2*center + 2;
+
+    if (channel == 3)
+        scratch.grayRing.resize((size_t)capacity * width);
+    scratch.fixedRing.resize((size_t)capacity * 3 * width);
+
+    // Sobel lines padded by 1 pixel, tensor planes padded by the radius, blurred tensor planes
+    int padded = width + 2*center;
+    scratch.sobelLines.resize(2*(width+2));
+    scratch.fixedLines.resize(3*padded + 3*width);
+    short *pFx = scratch.sobelLines.data() + 1;
+    short *pFy = pFx + width + 2;
+    int *pTensor = scratch.fixedLines.data() + center;
+    int *pBlur = scratch.fixedLines.data() + 3*padded;
+
+    unsigned char *pGrayRing = scratch.grayRing.data();
+    int *pFixedRing = scratch.fixedRing.data();
+    auto grayRow = [&](int y) -> const unsigned char* {
+        return (channel == 3) ? pGrayRing + (size_t)(y % capacity) * width : img.GetRow<unsigned char>(y);
+    };
+    auto blurRow = [&](int y) -> int* {
+        return pFixedRing + (size_t)(y % capacity) * 3 * width;
+    };
+
+    vector<const int*> rows(size);
+    int grayNext = max(rowBegin - center - 1, 0);
+    int blurNext = max(rowBegin - center, 0);
+    float h11, h12, h22, trace, det;
+    long long *pStageTime = Profiler::IsEnabled() ? scratch.stageTime : nullptr;
+    long long t0 = 0, t1 = 0, t2 = 0;
+
+    for (int r0 = rowBegin; r0 < rowEnd; r0 += stripRows) {
+        int r1 = min(r0 + stripRows, rowEnd);
+        int blurLast = min(r1 - 1 + center, height - 1);
+        int grayLast = min(blurLast + 1, height - 1);
+
+        if (channel == 3) {
+            t0 = pStageTime ? Profiler::Now() : 0;
+            for (; grayNext <= grayLast; ++grayNext)
+                GrayRow(img, grayNext, pGrayRing + (size_t)(grayNext % capacity) * width);
+            if (pStageTime)
+                pStageTime[STAGE_GRAY] += Profiler::Now() - t0;
+        }
+
+        // Sobel into int16, tensor into int32 and horizontal blur
+        for (; blurNext <= blurLast; ++blurNext) {
+            int y = blurNext;
+            const unsigned char *ppGray[3] = {
+                grayRow(y > 0 ? y-1 : 0),
+                grayRow(y),
+                grayRow(y < height-1 ? y+1 : height-1),
+            };
+            t0 = pStageTime ? Profiler::Now() : 0;
+            SobelColumnsFixed(ppGray, pFx, pFy, width);
+            ReplicateRowEdges(pFx, width, 1, 1);
+            ReplicateRowEdges(pFy, width, 1, 1);
+            t1 = pStageTime ? Profiler::Now() : 0;
+            // the tensor stage takes the horizontal Sobel pass too, it is one step with the products
+            SobelTensorFixed(pFx, pFy, pTensor, pTensor + padded, pTensor + 2*padded, width);
+            t2 = pStageTime ? Profiler::Now() : 0;
+            for (int p = 0; p < 3; ++p) {
+                ReplicateRowEdges(pTensor + p*padded, width, 1, center);
+                ConvolveRowFixed(pTensor + p*padded, pKernel, size, center, shift, blurRow(y) + p*width, width);
+            }
+            if (pStageTime) {
+                pStageTime[STAGE_SOBEL] += t1 - t0;
+                pStageTime[STAGE_TENSOR] += t2 - t1;
+                pStageTime[STAGE_BLUR] += Profiler::Now() - t2;
+            }
+        }
+
+        // vertical blur and harris's response function
+        for (int y = r0; y < r1; ++y) {
+            t0 = pStageTime ? Profiler::Now() : 0;
+            for (int p = 0; p < 3; ++p) {
+                for (int i = 0; i < size; ++i)
+                    rows[i] = blurRow(min(max(y+i-center, 0), height-1)) + p*width;
+                ConvolveColumnsFixed(rows.data(), pKernel, size, shift, pBlur + p*width, width);
+            }
+            t2 = pStageTime ? Profiler::Now() : 0;
+
+            float *pResp = response.GetRow<float>(y);
+            for (int x = 0; x < width; ++x) {
+                h11 = (float)pBlur[x];
+                h12 = (float)pBlur[width + x];
+                h22 = (float)pBlur[2*width + x];
+                det = h11 * h22 - h12 * h12;
+                trace = h11 + h22;
+                pResp[x] = det - k * trace * trace;
+            }
+            if (pStageTime) {
+                pStageTime[STAGE_BLUR] += t2 - t0;
+                pStageTime[STAGE_RESPONSE] += Profiler::Now() - t2;
+            }
+        }
+    }
+}
+
+}
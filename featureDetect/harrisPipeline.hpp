@@ -0,0 +1,79 @@
+#ifndef __HARRISPIPELINE_HPP__
+#define __HARRISPIPELINE_HPP__
+
+#include "image.hpp"
+#include <vector>
+
+namespace shun {
+
+    // Fused Harris response: gray, Sobel, structure tensor, separable blur and
+    // response run strip by strip, so only rings of rows as tall as the kernel
+    // apron are kept instead of full-frame intermediates. The frame is split into
+    // row bands across the shared thread pool, each band recomputes its apron.
+    // The result is bit-identical to the chain of Image filters.
+    // With mFixedPoint an 8-bit input runs in integers instead: Sobel in int16, the tensor
+    // in int32 and the blur with Q10 weights, only the response is computed in float. The
+    // response then stays within 1% of its range of the float one for sigma up to 4.
+    // While the Profiler is enabled, Run() records one event per stage (gray, sobel, tensor,
+    // blur, response). The stages interleave row by row, so each event gets the share of the
+    // wall time that the stage's summed row time takes.
+    class HarrisPipeline {
+        public:
+            HarrisPipeline(): mStripBytes{512 * 1024}, mFixedPoint{0} {}
+            virtual ~HarrisPipeline() {}
+
+            // img has 1 or 3 channels, interleaved or planar, response becomes 1-channel FLOAT32
+            CVError Run(const Image &img, float sigma, float k, Image &response);
+
+            int mStripBytes;    // working set budget of one strip, about the L2 size
+            int mFixedPoint;    // 1: the integer path for UINT8 input
+
+            // The float row steps, shared with HarrisStream. TensorRow() makes the horizontally blurred
+            // tensor row, interleaved xx, xy, yy, from the gray rows above, at and below it, in the
+            // TensorLineFloats() floats of pLines. ResponseRow() blurs the size tensor rows around a
+            // row vertically into pBlur, 3*width floats, and writes its response. Both add the ns of
+            // their stages to pStageTime, STAGE_COUNT of them, if it is not nullptr.
+            template <typename T>
+            static void TensorRow(const T * const *ppGray, int width, const float *pKernel, int size, int center,
+                                  float *pLines, float *pDst, long long *pStageTime = nullptr);
+            static void ResponseRow(const float * const *ppRows, int width, const float *pKernel, int size, float k,
+                                    float *pBlur, float *pResp, long long *pStageTime = nullptr);
+            static size_t TensorLineFloats(int width, int center) { return 2*(width+2) + 2*width + 3*(width+2*center); }
+
+            // the stages of the profile events, the index into pStageTime
+            enum Stage : int {
+                STAGE_GRAY = 0,
+                STAGE_SOBEL,
+                STAGE_TENSOR,
+                STAGE_BLUR,
+                STAGE_RESPONSE,
+                STAGE_COUNT,
+            };
+
+        protected:
+            // the rings and lines of one band
+            struct Scratch {
+                std::vector<unsigned char> grayRing;    // gray rows, only for 3-channel input
+                std::vector<float> blurRing;            // horizontally blurred tensor rows
+                std::vector<float> lines;               // per-row scratch
+                std::vector<int> fixedRing;             // horizontally blurred tensor rows, planar, fixed point
+                std::vector<int> fixedLines;            // per-row scratch of the fixed-point path
+                std::vector<short> sobelLines;
+                long long stageTime[STAGE_COUNT];   // ns per stage, summed only while profiling
+            };
+
+            template <typename T>
+            void RunRows(const Image &img, float k, Image &response, int rowBegin, int rowEnd, Scratch &scratch);
+            void RunRowsFixed(const Image &img, float k, Image &response, int rowBegin, int rowEnd, Scratch &scratch);
+            void RecordStages(int bands, long long start, long long duration, const long long *pBytes) const;
+
+            int mSize;          // Gaussian taps
+            int mCenter;        // Gaussian radius, the apron of the vertical blur
+            std::vector<float> mKernel;
+            std::vector<int> mFixedKernel;  // mKernel in Q10
+            std::vector<Scratch> mScratch;
+    };
+
+}
+
+#endif // __HARRISPIPELINE_HPP__
@@ -0,0 +1,200 @@
+#include "harrisStream.hpp"
+#include "boundedQueue.hpp"
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+using namespace std;
+
+namespace shun {
+
+// decoded rows travelling from the decoder to the detection
+struct StreamBlock {
+    vector<unsigned char> mPixels;
+    int mRows;
+};
+
+HarrisStream::HarrisStream():
+    FeatureDetect(), mBlockRows{16}, mQueueSize{4}, mWidth{0}, mHeight{0}, mChannel{0}, mSize{0}, mCenter{0},
+    mNmsSize{0}, mRadius{0}, mK{0.0f}, mThd{0.0f}, mNextRow{0}, mNextTensor{0}, mNextResponse{0}, mNextCorner{0}
+{
+}
+
+CVError HarrisStream::Begin(int width, int height, int channel, const HarrisParam &param)
+{
+    CVError status = CVError::NOERROR;
+
+    if (width <= 0 || height <= 0 || (channel != 1 && channel != 3) ||
+        param.blurMode != BlurMode::GAUSSIAN || !(param.rawThd > 0.0f)) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    Image kernel;
+    status = GaussianKernel(kernel, mSize, mCenter, param.sigma);
+    SHOW_ERROR_AND_RETURN(status);
+    mKernel.assign(kernel.GetData<float>(), kernel.GetData<float>() + mSize);
+
+    mWidth = width;
+    mHeight = height;
+    mChannel = channel;
+    mNmsSize = (param.nmsSize > 1) ? param.nmsSize : 0;
+    mRadius = mNmsSize / 2;
+    mK = param.k;
+    mThd = param.rawThd;
+    mNextRow = 0;
+    mNextTensor = 0;
+    mNextResponse = 0;
+    mNextCorner = 0;
+
+    // a tensor row is dropped once the response below it no longer needs it, a response
+    // row once the corners below it are out
+    mGray.resize((size_t)3 * width);
+    mTensor.resize((size_t)mSize * 3 * width);
+    mResponse.resize((size_t)(2*mRadius+1) * width);
+    mLines.resize(HarrisPipeline::TensorLineFloats(width, mCenter) + (size_t)3 * width);
+    mRows.resize(mSize);
+
+    return status;
+}
+
+size_t HarrisStream::GetWorkingBytes() const
+{
+    return mKernel.capacity() * sizeof(float) + mGray.capacity() + mTensor.capacity() * sizeof(float) +
+           mResponse.capacity() * sizeof(float) + mLines.capacity() * sizeof(float);
+}
+
+CVError HarrisStream::PushRow(const unsigned char *pRow, HarrisResult &result)
+{
+    CVError status = CVError::NOERROR;
+
+    if (pRow == nullptr || mNextRow >= mHeight) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    int y = mNextRow++;
+    if (mChannel == 3)
+        RGB2GrayRow(pRow, GrayRow(y), mWidth);
+    else
+        memcpy(GrayRow(y), pRow, mWidth);
+
+    // every stage runs as far as its window allows, the bottom row of a stage completes the next one
+    float *pBlur = mLines.data() + HarrisPipeline::TensorLineFloats(mWidth, mCenter);
+    int tensorLast = (y == mHeight-1) ? mHeight - 1 : y - 1;
+    for (; mNextTensor <= tensorLast; ++mNextTensor) {
+        int t = mNextTensor;
+        const unsigned char *ppGray[3] = {
+            GrayRow(t > 0 ? t-1 : 0),
+            GrayRow(t),
+            GrayRow(t < mHeight-1 ? t+1 : mHeight-1),
+        };
+        HarrisPipeline::TensorRow(ppGray, mWidth, mKernel.data(), mSize, mCenter, mLines.data(), TensorRow(t));
+
+        int responseLast = (t == mHeight-1) ? mHeight - 1 : t - mCenter;
+        for (; mNextResponse <= responseLast; ++mNextResponse) {
+            int r = mNextResponse;
+            for (int i = 0; i < mSize; ++i)
+                mRows[i] = TensorRow(min(max(r+i-mCenter, 0), mHeight-1));
+            HarrisPipeline::ResponseRow(mRows.data(), mWidth, mKernel.data(), mSize, mK, pBlur, ResponseRow(r));
+
+            int cornerLast = (r == mHeight-1) ? mHeight - 1 : r - mRadius;
+            for (; mNextCorner <= cornerLast; ++mNextCorner)
+                AddCorners(mNextCorner, result);
+        }
+    }
+
+    return status;
+}
+
+void HarrisStream::AddCorners(int y, HarrisResult &result)
+{
+    const float *pResp = ResponseRow(y);
+    int y0 = max(y - mRadius, 0), y1 = min(y + mRadius, mHeight - 1);
+
+    for (int x = 0; x < mWidth; ++x) {
+        float value = pResp[x];
+        if (!(value > mThd))
+            continue;
+
+        // the window and tie rule of SuppressNonMax
+        bool isMax = true;
+        if (mNmsSize > 1) {
+            int x0 = max(x - mRadius, 0), x1 = min(x + mRadius, mWidth - 1);
+            for (int v = y0; v <= y1 && isMax; ++v) {
+                const float *pRow = ResponseRow(v);
+                for (int u = x0; u <= x1; ++u) {
+                    bool before = (v < y) || (v == y && u < x);
+                    if (pRow[u] > value || (before && pRow[u] == value)) {
+                        isMax = false;
+                        break;
+                    }
+                }
+            }
+        }
+        if (isMax)
+            result.Add(x, y, value);
+    }
+}
+
+CVError HarrisStream::FindFeature(const char *pName, const HarrisParam &param, HarrisResult &result,
+                                  const JpegReadParam &readParam)
+{
+    CVError status = CVError::NOERROR;
+
+    JpegScanlineReader reader;
+    status = reader.Open(pName, readParam);
+    SHOW_ERROR_AND_RETURN(status);
+    status = Begin(reader.GetWidth(), reader.GetHeight(), reader.GetChannel(), param);
+    SHOW_ERROR_AND_RETURN(status);
+    result.Clear();
+
+    // the blocks circulate between the two queues, so the rows in flight stay bounded
+    int blockRows = max(mBlockRows, 1);
+    int blocks = max(mQueueSize, 1);
+    size_t rowBytes = (size_t)mWidth * mChannel;
+    BoundedQueue<StreamBlock> freeQueue(blocks);
+    BoundedQueue<StreamBlock> fullQueue(blocks);
+    for (int i = 0; i < blocks; ++i) {
+        StreamBlock block;
+        block.mPixels.resize(blockRows * rowBytes);
+        block.mRows = 0;
+        freeQueue.Push(move(block));
+    }
+
+    CVError decodeStatus = CVError::NOERROR;
+    thread decoder([&] {
+        StreamBlock block;
+        vector<unsigned char*> rows(blockRows);
+        while (reader.GetNextRow() < reader.GetHeight() && freeQueue.Pop(block)) {
+            for (int i = 0; i < blockRows; ++i)
+                rows[i] = block.mPixels.data() + i * rowBytes;
+            decodeStatus = reader.ReadRows(rows.data(), blockRows, block.mRows);
+            if (decodeStatus != CVError::NOERROR || block.mRows == 0 || !fullQueue.Push(move(block)))
+                break;
+        }
+        fullQueue.Close();
+    });
+
+    StreamBlock block;
+    while (status == CVError::NOERROR && fullQueue.Pop(block)) {
+        for (int i = 0; i < block.mRows && status == CVError::NOERROR; ++i)
+            status = PushRow(block.mPixels.data() + i * rowBytes, result);
+        freeQueue.Push(move(block));
+    }
+
+    // a decoder waiting on either queue gives up
+    freeQueue.Close();
+    fullQueue.Close();
+    decoder.join();
+    SHOW_ERROR_AND_RETURN(status);
+    SHOW_ERROR_AND_RETURN(decodeStatus);
+    if (mNextRow != mHeight) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    return status;
+}
+
+}
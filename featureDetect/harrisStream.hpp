@@ -0,0 +1,68 @@
+#ifndef __HARRISSTREAM_HPP__
+#define __HARRISSTREAM_HPP__
+
+#include "harrisDetect.hpp"
+#include <vector>
+
+namespace shun {
+
+    // Harris corners of an image that arrives row by row, e.g. a JPEG too large to hold decoded.
+    // Gray, tensor and response are rings of 3, kernel size and nmsSize rows, so the memory is
+    // O(width * kernel size) for any height, and the corners of a row are reported as soon as the
+    // rows below it that its windows need have arrived. Responses and corners equal those of
+    // HarrisDetect on the whole image with the same param, GAUSSIAN float path. The relative thd
+    // needs the response range of the whole image, so a stream thresholds on param.rawThd, and
+    // maxCorners and the grid are left to the caller.
+    class HarrisStream : public FeatureDetect {
+        public:
+            HarrisStream();
+            virtual ~HarrisStream() {}
+
+            // starts an image of width x height, the rows are 1-channel gray or interleaved RGB UINT8
+            CVError Begin(int width, int height, int channel, const HarrisParam &param);
+            // takes the next row, the corners of the rows it completes are appended to result in raster order
+            CVError PushRow(const unsigned char *pRow, HarrisResult &result);
+            int GetWidth() const { return mWidth; }
+            int GetHeight() const { return mHeight; }
+            int GetNextRow() const { return mNextRow; }     // rows pushed so far
+            size_t GetWorkingBytes() const;                 // the rings and lines, independent of the height
+
+            // streams a JPEG file into result, the decoding runs on its own thread mBlockRows rows
+            // ahead at a time, at most mQueueSize blocks ahead of the detection
+            CVError FindFeature(const char *pName, const HarrisParam &param, HarrisResult &result,
+                                const JpegReadParam &readParam = JpegReadParam());
+
+            int mBlockRows;
+            int mQueueSize;
+
+        protected:
+            unsigned char *GrayRow(int y) { return mGray.data() + (size_t)(y % 3) * mWidth; }
+            float *TensorRow(int y) { return mTensor.data() + (size_t)(y % mSize) * 3 * mWidth; }
+            float *ResponseRow(int y) { return mResponse.data() + (size_t)(y % (2*mRadius+1)) * mWidth; }
+            // thresholds row y and keeps the maxima of its nmsSize window
+            void AddCorners(int y, HarrisResult &result);
+
+            int mWidth;
+            int mHeight;
+            int mChannel;
+            int mSize;          // Gaussian kernel size and center
+            int mCenter;
+            int mNmsSize;
+            int mRadius;        // of the suppression window
+            float mK;
+            float mThd;
+            int mNextRow;       // the next row of each stage
+            int mNextTensor;
+            int mNextResponse;
+            int mNextCorner;
+            std::vector<float> mKernel;
+            std::vector<unsigned char> mGray;
+            std::vector<float> mTensor;     // horizontally blurred tensor rows, interleaved xx, xy, yy
+            std::vector<float> mResponse;
+            std::vector<float> mLines;      // the lines of HarrisPipeline::TensorRow, then the vertical blur
+            std::vector<const float*> mRows;    // the tensor rows of one vertical blur
+    };
+
+}
+
+#endif // __HARRISSTREAM_HPP__
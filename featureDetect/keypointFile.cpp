@@ -0,0 +1,262 @@
+#include "keypointFile.hpp"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace shun {
+
+static uint64_t AlignUp8(uint64_t offset)
+{
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+void KeypointSpan::CopyTo(FeatureResult &result) const
+{
+    result.mX.assign(mpX, mpX + mCount);
+    result.mY.assign(mpY, mpY + mCount);
+    result.mResponse.assign(mpResponse, mpResponse + mCount);
+    if (mpScale)
+        result.mScale.assign(mpScale, mpScale + mCount);
+    else
+        result.mScale.assign(mCount, 1);
+}
+
+CVError KeypointWriter::Open(const char *pName)
+{
+    CVError status = CVError::NOERROR;
+
+    if (mpFile != nullptr) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    mpFile = fopen(pName, "wb");
+    if (mpFile == nullptr) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // a zero header until Close, readers reject it
+    KeypointFileHeader header;
+    memset(&header, 0, sizeof(header));
+    mFailed = false;
+    mOffset = 0;
+    mCornerCount = 0;
+    mNames.clear();
+    mIndex.clear();
+    return Write(&header, sizeof(header));
+}
+
+CVError KeypointWriter::Write(const void *pData, size_t bytes)
+{
+    CVError status = CVError::NOERROR;
+
+    if (mpFile == nullptr) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // the offsets are off after a short write, nothing more is written and Close reports it
+    if (mFailed)
+        return CVError::FILEACCESS;
+    if (bytes > 0 && fwrite(pData, 1, bytes, mpFile) != bytes) {
+        mFailed = true;
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+    mOffset += bytes;
+
+    return status;
+}
+
+CVError KeypointWriter::Add(const FeatureResult &result, int width, int height, const string &name)
+{
+    CVError status = CVError::NOERROR;
+
+    size_t count = result.mX.size();
+    if (result.mY.size() != count || result.mResponse.size() != count || result.mScale.size() != count ||
+        width < 0 || height < 0 || count > INT_MAX || name.size() > INT_MAX) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    KeypointIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.mOffset = mOffset;
+    entry.mNameOffset = mNames.size();  // relative until Close
+    entry.mNameBytes = (uint32_t)name.size();
+    entry.mCount = (uint32_t)count;
+    entry.mWidth = (uint32_t)width;
+    entry.mHeight = (uint32_t)height;
+    bool hasScale = any_of(result.mScale.begin(), result.mScale.end(), [](int s) { return s != 1; });
+    entry.mFlags = hasScale ? (uint32_t)KEYPOINT_HAS_SCALE : 0u;
+
+    static_assert(sizeof(int) == 4 && sizeof(float) == 4, "keypoint arrays are 32-bit");
+    status = Write(result.mX.data(), count * sizeof(int));
+    SHOW_ERROR_AND_RETURN(status);
+    status = Write(result.mY.data(), count * sizeof(int));
+    SHOW_ERROR_AND_RETURN(status);
+    status = Write(result.mResponse.data(), count * sizeof(float));
+    SHOW_ERROR_AND_RETURN(status);
+    if (hasScale) {
+        status = Write(result.mScale.data(), count * sizeof(int));
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    const char pad[8] = {0};
+    status = Write(pad, AlignUp8(mOffset) - mOffset);
+    SHOW_ERROR_AND_RETURN(status);
+
+    mNames += name;
+    mIndex.push_back(entry);
+    mCornerCount += count;
+
+    return status;
+}
+
+CVError KeypointWriter::Close()
+{
+    CVError status = CVError::NOERROR;
+
+    if (mpFile == nullptr)
+        return status;
+
+    uint64_t nameBase = mOffset;
+    for (KeypointIndexEntry &entry : mIndex)
+        entry.mNameOffset += nameBase;
+
+    // a failed write only sets mFailed, the file is closed below either way
+    const char pad[8] = {0};
+    Write(mNames.data(), mNames.size());
+    Write(pad, AlignUp8(mOffset) - mOffset);
+
+    KeypointFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.mMagic, KeypointFileMagic, sizeof(header.mMagic));
+    header.mVersion = KeypointFileVersion;
+    header.mByteOrder = KeypointFileByteOrder;
+    header.mImageCount = mIndex.size();
+    header.mCornerCount = mCornerCount;
+    header.mIndexOffset = mOffset;
+    header.mFileBytes = mOffset + mIndex.size() * sizeof(KeypointIndexEntry);
+
+    Write(mIndex.data(), mIndex.size() * sizeof(KeypointIndexEntry));
+
+    // the header goes last, a failed or interrupted writer leaves the zero one in place
+    bool failed = mFailed || fflush(mpFile) != 0 || fseek(mpFile, 0, SEEK_SET) != 0 ||
+                  fwrite(&header, 1, sizeof(header), mpFile) != sizeof(header);
+    failed = (fclose(mpFile) != 0) || failed;
+    mpFile = nullptr;
+    mFailed = false;
+    mNames.clear();
+    mIndex.clear();
+    if (failed) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    return status;
+}
+
+CVError KeypointReader::Open(const char *pName)
+{
+    CVError status = CVError::NOERROR;
+
+    Close();
+
+    int fd = open(pName, O_RDONLY);
+    if (fd < 0) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(KeypointFileHeader)) {
+        close(fd);
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    size_t size = (size_t)info.st_size;
+    void *pMap = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pMap == MAP_FAILED) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    mpMap = static_cast<const unsigned char*>(pMap);
+    mBytes = size;
+
+    // a truncated, unfinished or foreign file
+    const KeypointFileHeader *pHeader = reinterpret_cast<const KeypointFileHeader*>(mpMap);
+    if (memcmp(pHeader->mMagic, KeypointFileMagic, sizeof(pHeader->mMagic)) != 0 ||
+        pHeader->mVersion != KeypointFileVersion || pHeader->mByteOrder != KeypointFileByteOrder ||
+        pHeader->mFileBytes != size || pHeader->mImageCount > INT_MAX ||
+        pHeader->mIndexOffset % 8 != 0 || pHeader->mIndexOffset < sizeof(KeypointFileHeader) ||
+        pHeader->mIndexOffset > size ||
+        (size - pHeader->mIndexOffset) / sizeof(KeypointIndexEntry) < pHeader->mImageCount) {
+        Close();
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    mpHeader = pHeader;
+    mpIndex = reinterpret_cast<const KeypointIndexEntry*>(mpMap + pHeader->mIndexOffset);
+
+    return status;
+}
+
+void KeypointReader::Close()
+{
+    if (mpMap != nullptr)
+        munmap(const_cast<unsigned char*>(mpMap), mBytes);
+    mpMap = nullptr;
+    mBytes = 0;
+    mpHeader = nullptr;
+    mpIndex = nullptr;
+}
+
+CVError KeypointReader::GetImage(int index, KeypointSpan &span) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (mpHeader == nullptr || index < 0 || index >= GetImageCount()) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // the blocks and names lie between the header and the index
+    const KeypointIndexEntry &entry = mpIndex[index];
+    uint64_t end = mpHeader->mIndexOffset;
+    uint64_t arrays = (entry.mFlags & KEYPOINT_HAS_SCALE) ? 4 : 3;
+    if (entry.mCount > INT_MAX || entry.mWidth > INT_MAX || entry.mHeight > INT_MAX ||
+        entry.mNameBytes > INT_MAX || entry.mOffset % 8 != 0 ||
+        entry.mOffset < sizeof(KeypointFileHeader) || entry.mOffset > end ||
+        (end - entry.mOffset) / (4 * arrays) < entry.mCount ||
+        entry.mNameOffset > end || end - entry.mNameOffset < entry.mNameBytes) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    const unsigned char *pBlock = mpMap + entry.mOffset;
+    span.mCount = (int)entry.mCount;
+    span.mWidth = (int)entry.mWidth;
+    span.mHeight = (int)entry.mHeight;
+    span.mpX = reinterpret_cast<const int*>(pBlock);
+    span.mpY = span.mpX + span.mCount;
+    span.mpResponse = reinterpret_cast<const float*>(span.mpY + span.mCount);
+    span.mpScale = (entry.mFlags & KEYPOINT_HAS_SCALE) ? span.mpX + 3 * (size_t)span.mCount : nullptr;
+    span.mpName = reinterpret_cast<const char*>(mpMap + entry.mNameOffset);
+    span.mNameBytes = (int)entry.mNameBytes;
+
+    return status;
+}
+
+}
@@ -0,0 +1,130 @@
+#ifndef __KEYPOINTFILE_HPP__
+#define __KEYPOINTFILE_HPP__
+
+#include "featureDetect.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace shun {
+
+    // Binary keypoint file, native byte order, every offset in bytes from the file start:
+    //   header      KeypointFileHeader
+    //   blocks      per image: int32 x[n], int32 y[n], float response[n], int32 scale[n],
+    //               scale is left out when all the corners are at full resolution. Every block
+    //               and the index start 8-byte aligned, the reader rejects other offsets since
+    //               its spans point into the mapping
+    //   names       the image names, not terminated
+    //   index       KeypointIndexEntry per image, in the order they were added
+    // The header is written last, a file whose writer did not finish has no valid magic.
+
+    const char KeypointFileMagic[8] = {'S', 'H', 'U', 'N', 'K', 'P', 'T', '\0'};
+    const uint32_t KeypointFileVersion = 1;
+    const uint32_t KeypointFileByteOrder = 0x01020304;
+
+    struct KeypointFileHeader {
+            char mMagic[8];
+            uint32_t mVersion;
+            uint32_t mByteOrder;    // KeypointFileByteOrder as the writer saw it
+            uint64_t mImageCount;
+            uint64_t mCornerCount;  // of all images
+            uint64_t mIndexOffset;
+            uint64_t mFileBytes;
+            uint64_t mReserved[2];
+    };
+
+    enum KeypointFlag : uint32_t {
+        KEYPOINT_HAS_SCALE = 1,
+    };
+
+    struct KeypointIndexEntry {
+            uint64_t mOffset;       // of the x array
+            uint64_t mNameOffset;
+            uint32_t mNameBytes;
+            uint32_t mCount;
+            uint32_t mWidth;
+            uint32_t mHeight;
+            uint32_t mFlags;        // KeypointFlag
+            uint32_t mReserved;
+    };
+
+    static_assert(sizeof(KeypointFileHeader) == 64, "keypoint file header layout");
+    static_assert(sizeof(KeypointIndexEntry) == 40, "keypoint index entry layout");
+
+    // the corners of one image, pointing into the mapped file
+    struct KeypointSpan {
+            KeypointSpan(): mCount{0}, mWidth{0}, mHeight{0}, mpX{nullptr}, mpY{nullptr}, mpResponse{nullptr},
+                            mpScale{nullptr}, mpName{nullptr}, mNameBytes{0} {}
+
+            int GetScale(int i) const { return mpScale ? mpScale[i] : 1; }
+            std::string GetName() const { return std::string(mpName, mNameBytes); }
+            // copies the corners out of the mapping
+            void CopyTo(FeatureResult &result) const;
+
+            int mCount;
+            int mWidth;
+            int mHeight;
+            const int *mpX;
+            const int *mpY;
+            const float *mpResponse;
+            const int *mpScale;     // nullptr when every corner is at scale 1
+            const char *mpName;
+            int mNameBytes;
+    };
+
+    // Appends the corners of one image after another, only the index stays in memory.
+    class KeypointWriter {
+        public:
+            KeypointWriter(): mpFile{nullptr}, mFailed{false}, mOffset{0}, mCornerCount{0} {}
+            virtual ~KeypointWriter() { Close(); }
+
+            CVError Open(const char *pName);
+            // width and height are those of the searched image
+            CVError Add(const FeatureResult &result, int width, int height, const std::string &name = "");
+            // writes the names, the index and the header, a writer is closed once. FILEACCESS if
+            // any write since Open failed, the file then keeps its zero header
+            CVError Close();
+            int GetCount() const { return (int)mIndex.size(); }
+
+        private:
+            KeypointWriter(const KeypointWriter&) = delete;
+            KeypointWriter &operator=(const KeypointWriter&) = delete;
+
+            CVError Write(const void *pData, size_t bytes);
+
+            FILE *mpFile;
+            bool mFailed;           // a write failed, the file stays open until Close
+            uint64_t mOffset;
+            uint64_t mCornerCount;
+            std::string mNames;
+            std::vector<KeypointIndexEntry> mIndex;
+    };
+
+    // Maps a keypoint file read only, the spans stay valid until Close. GetImage is
+    // safe to call from several threads.
+    class KeypointReader {
+        public:
+            KeypointReader(): mpMap{nullptr}, mBytes{0}, mpHeader{nullptr}, mpIndex{nullptr} {}
+            virtual ~KeypointReader() { Close(); }
+
+            // checks the header and the index bounds, the blocks are checked by GetImage
+            CVError Open(const char *pName);
+            void Close();
+            int GetImageCount() const { return mpHeader ? (int)mpHeader->mImageCount : 0; }
+            uint64_t GetCornerCount() const { return mpHeader ? mpHeader->mCornerCount : 0; }
+            CVError GetImage(int index, KeypointSpan &span) const;
+
+        private:
+            KeypointReader(const KeypointReader&) = delete;
+            KeypointReader &operator=(const KeypointReader&) = delete;
+
+            const unsigned char *mpMap;
+            size_t mBytes;
+            const KeypointFileHeader *mpHeader;
+            const KeypointIndexEntry *mpIndex;
+    };
+
+}
+
+#endif // __KEYPOINTFILE_HPP__
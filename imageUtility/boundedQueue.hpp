@@ -0,0 +1,90 @@
+#ifndef __BOUNDEDQUEUE_HPP__
+#define __BOUNDEDQUEUE_HPP__
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace shun {
+
+    // A FIFO between pipeline stages. Push() blocks while the queue is full, so a
+    // fast producer cannot run ahead of its consumer by more than the capacity.
+    // After Close() Push() fails and Pop() drains what is left, then fails.
+    template <typename T>
+    class BoundedQueue {
+        public:
+            explicit BoundedQueue(size_t capacity): mCapacity{capacity ? capacity : 1}, mClosed{false} {}
+            virtual ~BoundedQueue() {}
+
+            bool Push(T &&item)
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mNotFull.wait(lock, [this] { return mClosed || mItems.size() < mCapacity; });
+                if (mClosed)
+                    return false;
+                mItems.push_back(std::move(item));
+                mNotEmpty.notify_one();
+                return true;
+            }
+
+            // never blocks, false if the queue is full or closed
+            bool TryPush(T &&item)
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (mClosed || mItems.size() >= mCapacity)
+                    return false;
+                mItems.push_back(std::move(item));
+                mNotEmpty.notify_one();
+                return true;
+            }
+
+            bool Pop(T &item)
+            {
+                std::unique_lock<std::mutex> lock(mMutex);
+                mNotEmpty.wait(lock, [this] { return mClosed || !mItems.empty(); });
+                if (mItems.empty())
+                    return false;
+                item = std::move(mItems.front());
+                mItems.pop_front();
+                mNotFull.notify_one();
+                return true;
+            }
+
+            // never blocks, false if the queue is empty
+            bool TryPop(T &item)
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (mItems.empty())
+                    return false;
+                item = std::move(mItems.front());
+                mItems.pop_front();
+                mNotFull.notify_one();
+                return true;
+            }
+
+            void Close()
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mClosed = true;
+                mNotEmpty.notify_all();
+                mNotFull.notify_all();
+            }
+
+            size_t Size() const
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                return mItems.size();
+            }
+
+        protected:
+            size_t mCapacity;
+            bool mClosed;
+            std::deque<T> mItems;
+            mutable std::mutex mMutex;
+            std::condition_variable mNotEmpty;
+            std::condition_variable mNotFull;
+    };
+
+}
+
+#endif // __BOUNDEDQUEUE_HPP__
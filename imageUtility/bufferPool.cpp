@@ -0,0 +1,118 @@
+#include "bufferPool.hpp"
+#include <atomic>
+#include <cstdlib>
+
+using namespace std;
+
+namespace shun {
+
+static void* AlignedAlloc(size_t bytes)
+{
+    void *pBuffer = nullptr;
+    if (posix_memalign(&pBuffer, ImageAllocator::Alignment, bytes ? bytes : 1) != 0)
+        return nullptr;
+    return pBuffer;
+}
+
+class AlignedAllocator : public ImageAllocator {
+    public:
+        AlignedAllocator(): mAllocCount{0} {}
+        virtual void* Allocate(size_t bytes) { ++mAllocCount; return AlignedAlloc(bytes); }
+        virtual void Free(void *pBuffer, size_t) { free(pBuffer); }
+        virtual size_t GetAllocCount() const { return mAllocCount; }
+
+    protected:
+        atomic<size_t> mAllocCount;
+};
+
+ImageAllocator& ImageAllocator::Default()
+{
+    static AlignedAllocator allocator;
+    return allocator;
+}
+
+BufferPool::BufferPool(size_t maxCachedBytes)
+{
+    mMaxCachedBytes = maxCachedBytes;
+    mCachedBytes = 0;
+    mAllocCount = 0;
+    mReuseCount = 0;
+}
+
+BufferPool::~BufferPool()
+{
+    Trim();
+}
+
+// whole pages, so frames that differ by a few bytes still share a bucket
+size_t BufferPool::BucketSize(size_t bytes)
+{
+    const size_t page = 4096;
+    return (bytes + page - 1) / page * page;
+}
+
+void* BufferPool::Allocate(size_t bytes)
+{
+    size_t bucket = BucketSize(bytes);
+    {
+        lock_guard<mutex> lock(mMutex);
+        auto it = mBuckets.find(bucket);
+        if (it != mBuckets.end() && !it->second.empty()) {
+            void *pBuffer = it->second.back();
+            it->second.pop_back();
+            mCachedBytes -= bucket;
+            ++mReuseCount;
+            return pBuffer;
+        }
+        ++mAllocCount;
+    }
+    return ImageAllocator::Default().Allocate(bucket);
+}
+
+void BufferPool::Free(void *pBuffer, size_t bytes)
+{
+    if (pBuffer == nullptr)
+        return;
+
+    size_t bucket = BucketSize(bytes);
+    {
+        lock_guard<mutex> lock(mMutex);
+        if (mMaxCachedBytes == 0 || mCachedBytes + bucket <= mMaxCachedBytes) {
+            mBuckets[bucket].push_back(pBuffer);
+            mCachedBytes += bucket;
+            return;
+        }
+    }
+    ImageAllocator::Default().Free(pBuffer, bucket);
+}
+
+void BufferPool::Trim()
+{
+    lock_guard<mutex> lock(mMutex);
+    for (auto &bucket : mBuckets) {
+        for (void *pBuffer : bucket.second)
+            ImageAllocator::Default().Free(pBuffer, bucket.first);
+    }
+    mBuckets.clear();
+    mCachedBytes = 0;
+}
+
+size_t BufferPool::GetCachedBytes() const
+{
+    lock_guard<mutex> lock(mMutex);
+    return mCachedBytes;
+}
+
+size_t BufferPool::GetAllocCount() const
+{
+    lock_guard<mutex> lock(mMutex);
+    return mAllocCount;
+}
+
+size_t BufferPool::GetReuseCount() const
+{
+    lock_guard<mutex> lock(mMutex);
+    return mReuseCount;
+}
+
+}
@@ -0,0 +1,58 @@
+#ifndef __BUFFERPOOL_HPP__
+#define __BUFFERPOOL_HPP__
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+
+namespace shun {
+
+    // where Image gets its pixel buffers from, every buffer is aligned to Alignment bytes
+    class ImageAllocator {
+        public:
+            static const size_t Alignment = 64;
+
+            virtual ~ImageAllocator() {}
+            virtual void* Allocate(size_t bytes) = 0;
+            // bytes is the size passed to Allocate()
+            virtual void Free(void *pBuffer, size_t bytes) = 0;
+            // buffers taken from the system so far
+            virtual size_t GetAllocCount() const = 0;
+
+            // the allocator of images that were not given one and of the pools, plain aligned malloc/free
+            static ImageAllocator& Default();
+    };
+
+    // Keeps freed buffers in buckets of page-rounded size and hands them out again,
+    // so a loop over frames of one size stops calling the system allocator after
+    // the first frame. Thread-safe. Images using the pool must be released before it.
+    class BufferPool : public ImageAllocator {
+        public:
+            explicit BufferPool(size_t maxCachedBytes = 0);    // 0: no limit
+            virtual ~BufferPool();
+
+            virtual void* Allocate(size_t bytes);
+            virtual void Free(void *pBuffer, size_t bytes);
+
+            // give all cached buffers back to the system
+            void Trim();
+
+            size_t GetCachedBytes() const;
+            virtual size_t GetAllocCount() const;
+            size_t GetReuseCount() const;   // buffers served from the cache
+
+        protected:
+            static size_t BucketSize(size_t bytes);
+
+            size_t mMaxCachedBytes;
+            size_t mCachedBytes;
+            size_t mAllocCount;
+            size_t mReuseCount;
+            std::map<size_t, std::vector<void*>> mBuckets;
+            mutable std::mutex mMutex;
+    };
+
+}
+
+#endif // __BUFFERPOOL_HPP__
@@ -0,0 +1,899 @@
+#include "convolve.hpp"
+#include <atomic>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CONVOLVE_X86 1
+#include <immintrin.h>
+#else
+#define CONVOLVE_X86 0
+#endif
+
+namespace shun {
+
+// Scalar reference, the taps are accumulated in order from k = 0.
+// The helpers also finish the tails of the vector paths; they are kept out of line
+// so they are not inlined into an avx512f function and contracted into FMAs there.
+#if defined(__GNUC__)
+#define CONVOLVE_NOINLINE __attribute__((noinline))
+#else
+#define CONVOLVE_NOINLINE
+#endif
+
+template <typename T>
+CONVOLVE_NOINLINE static void ColumnsScalar(const T * const *ppRows, const float *pKernel, int size, float *pDst, int start, int count)
+{
+    for (int i = start; i < count; ++i) {
+        float sum = 0.0f;
+        for (int k = 0; k < size; ++k)
+            sum += (float)ppRows[k][i] * pKernel[k];
+        pDst[i] = sum;
+    }
+}
+
+CONVOLVE_NOINLINE static void RowScalar(const float *pSrc, int channel, const float *pKernel, int size, int center, float *pDst, int start, int count)
+{
+    const float *pTap = pSrc - center*channel;
+    for (int i = start; i < count; ++i) {
+        float sum = 0.0f;
+        for (int k = 0; k < size; ++k)
+            sum += pTap[i + k*channel] * pKernel[k];
+        pDst[i] = sum;
+    }
+}
+
+// the taps of a fixed-point pass: rows of a column pass or neighbors along a row
+struct ColumnTaps {
+    const int * const *ppRows;
+    const int* operator()(int k) const { return ppRows[k]; }
+};
+
+struct RowTaps {
+    const int *pFirst;
+    const int* operator()(int k) const { return pFirst + k; }
+};
+
+template <typename Taps>
+CONVOLVE_NOINLINE static void FixedScalar(Taps taps, const int *pKernel, int size, int shift, int *pDst, int start, int count)
+{
+    int half = size / 2;
+    int round = 1 << (shift - 1);
+    for (int i = start; i < count; ++i) {
+        int sum = taps(half)[i] * pKernel[half];
+        for (int k = 0; k < half; ++k)
+            sum += (taps(k)[i] + taps(size-1-k)[i]) * pKernel[k];
+        pDst[i] = (sum + round) >> shift;
+    }
+}
+
+CONVOLVE_NOINLINE static void SobelColumnsFixedScalar(const unsigned char * const *ppRows, short *pFx, short *pFy, int start, int count)
+{
+    for (int i = start; i < count; ++i) {
+        pFx[i] = (short)(ppRows[0][i] + 2*ppRows[1][i] + ppRows[2][i]);
+        pFy[i] = (short)(ppRows[2][i] - ppRows[0][i]);
+    }
+}
+
+CONVOLVE_NOINLINE static void SobelTensorFixedScalar(const short *pFx, const short *pFy, int *pXX, int *pXY, int *pYY, int start, int width)
+{
+    for (int x = start; x < width; ++x) {
+        int dx = pFx[x+1] - pFx[x-1];
+        int dy = pFy[x-1] + 2*pFy[x] + pFy[x+1];
+        pXX[x] = dx*dx;
+        pXY[x] = dx*dy;
+        pYY[x] = dy*dy;
+    }
+}
+
+CONVOLVE_NOINLINE static void MinMaxScalar(const float *pSrc, int start, int count, float &min, float &max)
+{
+    for (int i = start; i < count; ++i) {
+        if (min > pSrc[i])
+            min = pSrc[i];
+        if (max < pSrc[i])
+            max = pSrc[i];
+    }
+}
+
+// the lanes of the vector accumulators
+CONVOLVE_NOINLINE static void MinMaxLanes(const float *pMin, const float *pMax, int lanes, float &min, float &max)
+{
+    for (int i = 0; i < lanes; ++i) {
+        if (min > pMin[i])
+            min = pMin[i];
+        if (max < pMax[i])
+            max = pMax[i];
+    }
+}
+
+// Static kernels: the tap loops have a compile-time trip count and are unrolled, so the taps
+// become immediates. A zero tap is skipped: its +-0 product never changes a sum that starts
+// at +0, only an infinite or NaN input would, so finite results match the runtime passes.
+template <typename K, typename T>
+CONVOLVE_NOINLINE static void StaticColumnsScalar(const T * const *ppRows, float *pDst, int start, int count)
+{
+    for (int i = start; i < count; ++i) {
+        float sum = 0.0f;
+#pragma GCC unroll 16
+        for (int k = 0; k < K::size; ++k) {
+            if (K::taps[k] != 0.0f)
+                sum += (float)ppRows[k][i] * K::taps[k];
+        }
+        pDst[i] = sum;
+    }
+}
+
+template <typename K>
+CONVOLVE_NOINLINE static void StaticRowScalar(const float *pSrc, int channel, float *pDst, int start, int count)
+{
+    const float *pTap = pSrc - K::center*channel;
+    for (int i = start; i < count; ++i) {
+        float sum = 0.0f;
+#pragma GCC unroll 16
+        for (int k = 0; k < K::size; ++k) {
+            if (K::taps[k] != 0.0f)
+                sum += pTap[i + k*channel] * K::taps[k];
+        }
+        pDst[i] = sum;
+    }
+}
+
+#if CONVOLVE_X86
+
+// The min/max instructions return their second operand when either one is a NaN, so the
+// element comes first and a NaN leaves the running value as the scalar loop does.
+
+// SSE4.1: 4 lanes
+__attribute__((target("sse4.1")))
+static void ColumnsSse41(const float * const *ppRows, const float *pKernel, int size, float *pDst, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < size; ++k)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(ppRows[k] + i), _mm_set1_ps(pKernel[k])));
+        _mm_storeu_ps(pDst + i, sum);
+    }
+    ColumnsScalar(ppRows, pKernel, size, pDst, i, count);
+}
+
+__attribute__((target("sse4.1")))
+static void ColumnsSse41(const unsigned char * const *ppRows, const float *pKernel, int size, float *pDst, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < size; ++k) {
+            int packed;
+            __builtin_memcpy(&packed, ppRows[k] + i, sizeof(packed));
+            __m128 value = _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(value, _mm_set1_ps(pKernel[k])));
+        }
+        _mm_storeu_ps(pDst + i, sum);
+    }
+    ColumnsScalar(ppRows, pKernel, size, pDst, i, count);
+}
+
+__attribute__((target("sse4.1")))
+static void RowSse41(const float *pSrc, int channel, const float *pKernel, int size, int center, float *pDst, int count)
+{
+    const float *pTap = pSrc - center*channel;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (int k = 0; k < size; ++k)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(pTap + i + k*channel), _mm_set1_ps(pKernel[k])));
+        _mm_storeu_ps(pDst + i, sum);
+    }
+    RowScalar(pSrc, channel, pKernel, size, center, pDst, i, count);
+}
+
+// The AVX2 and AVX-512 paths clear the upper register halves before they return, call a helper
+// or run the scalar tail, GCC does not do it for target() functions. Without it
+// every following SSE instruction of the caller pays a state transition penalty.
+
+// AVX2: 8 lanes
+__attribute__((target("avx2")))
+static void ColumnsAvx2(const float * const *ppRows, const float *pKernel, int size, float *pDst, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < size; ++k)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(ppRows[k] + i), _mm256_set1_ps(pKernel[k])));
+        _mm256_storeu_ps(pDst + i, sum);
+    }
+    _mm256_zeroupper();
+    ColumnsScalar(ppRows, pKernel, size, pDst, i, count);
+}
+
+__attribute__((target("avx2")))
+static void ColumnsAvx2(const unsigned char * const *ppRows, const float *pKernel, int size, float *pDst, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < size; ++k) {
+            __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(ppRows[k] + i));
+            __m256 value = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(packed));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(value, _mm256_set1_ps(pKernel[k])));
+        }
+        _mm256_storeu_ps(pDst + i, sum);
+    }
+    _mm256_zeroupper();
+    ColumnsScalar(ppRows, pKernel, size, pDst, i, count);
+}
+
+__attribute__((target("avx2")))
+static void RowAvx2(const float *pSrc, int channel, const float *pKernel, int size, int center, float *pDst, int count)
+{
+    const float *pTap = pSrc - center*channel;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 sum = _mm256_setzero_ps();
+        for (int k = 0; k < size; ++k)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(pTap + i + k*channel), _mm256_set1_ps(pKernel[k])));
+        _mm256_storeu_ps(pDst + i, sum);
+    }
+    _mm256_zeroupper();
+    RowScalar(pSrc, channel, pKernel, size, center, pDst, i, count);
+}
+
+// AVX-512: 16 lanes. avx512f implies FMA, so the _round_ forms are used for the
+// multiply and add: they are builtins the compiler cannot contract into an FMA.
+// The maskz forms with a full mask avoid a GCC 12 -Wmaybe-uninitialized false positive.
+#define MUL_ADD_512(sum, a, b) \
+    _mm512_maskz_add_round_ps(0xFFFF, (sum), \
+        _mm512_maskz_mul_round_ps(0xFFFF, (a), (b), _MM_FROUND_CUR_DIRECTION), _MM_FROUND_CUR_DIRECTION)
+
+__attribute__((target("avx512f")))
+static void ColumnsAvx512(const float * const *ppRows, const float *pKernel, int size, float *pDst, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 sum = _mm512_setzero_ps();
+        for (int k = 0; k < size; ++k)
+            sum = MUL_ADD_512(sum, _mm512_loadu_ps(ppRows[k] + i), _mm512_set1_ps(pKernel[k]));
+        _mm512_storeu_ps(pDst + i, sum);
+    }
+    _mm256_zeroupper();
+    ColumnsScalar(ppRows, pKernel, size, pDst, i, count);
+}
+
+__attribute__((target("avx512f")))
+static void ColumnsAvx512(const unsigned char * const *ppRows, const float *pKernel, int size, float *pDst, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 sum = _mm512_setzero_ps();
+        for (int k = 0; k < size; ++k) {
+            __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ppRows[k] + i));
+            __m512 value = _mm512_maskz_cvtepi32_ps(0xFFFF, _mm512_maskz_cvtepu8_epi32(0xFFFF, packed));
+            sum = MUL_ADD_512(sum, value, _mm512_set1_ps(pKernel[k]));
+        }
+        _mm512_storeu_ps(pDst + i, sum);
+    }
+    _mm256_zeroupper();
+    ColumnsScalar(ppRows, pKernel, size, pDst, i, count);
+}
+
+__attribute__((target("avx512f")))
+static void RowAvx512(const float *pSrc, int channel, const float *pKernel, int size, int center, float *pDst, int count)
+{
+    const float *pTap = pSrc - center*channel;
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 sum = _mm512_setzero_ps();
+        for (int k = 0; k < size; ++k)
+            sum = MUL_ADD_512(sum, _mm512_loadu_ps(pTap + i + k*channel), _mm512_set1_ps(pKernel[k]));
+        _mm512_storeu_ps(pDst + i, sum);
+    }
+    _mm256_zeroupper();
+    RowScalar(pSrc, channel, pKernel, size, center, pDst, i, count);
+}
+
+// the static kernels at every level, with loads that widen 8-bit sources to float
+__attribute__((target("sse4.1")))
+static inline __m128 Load4(const float *pSrc)
+{
+    return _mm_loadu_ps(pSrc);
+}
+
+__attribute__((target("sse4.1")))
+static inline __m128 Load4(const unsigned char *pSrc)
+{
+    int packed;
+    __builtin_memcpy(&packed, pSrc, sizeof(packed));
+    return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(packed)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 Load8(const float *pSrc)
+{
+    return _mm256_loadu_ps(pSrc);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 Load8(const unsigned char *pSrc)
+{
+    return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pSrc))));
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 Load16(const float *pSrc)
+{
+    return _mm512_loadu_ps(pSrc);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 Load16(const unsigned char *pSrc)
+{
+    __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pSrc));
+    return _mm512_maskz_cvtepi32_ps(0xFFFF, _mm512_maskz_cvtepu8_epi32(0xFFFF, packed));
+}
+
+template <typename K, typename T>
+__attribute__((target("sse4.1")))
+static void StaticColumnsSse41(const T * const *ppRows, float *pDst, int count)
+{
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum = _mm_setzero_ps();
+#pragma GCC unroll 16
+        for (int k = 0; k < K::size; ++k) {
+            if (K::taps[k] != 0.0f)
+                sum = _mm_add_ps(sum, _mm_mul_ps(Load4(ppRows[k] + i), _mm_set1_ps(K::taps[k])));
+        }
+        _mm_storeu_ps(pDst + i, sum);
+    }
+    StaticColumnsScalar<K>(ppRows, pDst, i, count);
+}
+
+template <typename K>
+__attribute__((target("sse4.1")))
+static void StaticRowSse41(const float *pSrc, int channel, float *pDst, int count)
+{
+    const float *pTap = pSrc - K::center*channel;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 sum = _mm_setzero_ps();
+#pragma GCC unroll 16
+        for (int k = 0; k < K::size; ++k) {
+            if (K::taps[k] != 0.0f)
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(pTap + i + k*channel), _mm_set1_ps(K::taps[k])));
+        }
+        _mm_storeu_ps(pDst + i, sum);
+    }
+    StaticRowScalar<K>(pSrc, channel, pDst, i, count);
+}
+
+template <typename K, typename T>
+__attribute__((target("avx2")))
+static void StaticColumnsAvx2(const T * const *ppRows, float *pDst, int count)
+{
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 sum = _mm256_setzero_ps();
+#pragma GCC unroll 16
+        for (int k = 0; k < K::size; ++k) {
+            if (K::taps[k] != 0.0f)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(Load8(ppRows[k] + i), _mm256_set1_ps(K::taps[k])));
+        }
+        _mm256_storeu_ps(pDst + i, sum);
+    }
+    _mm256_zeroupper();
+    StaticColumnsScalar<K>(ppRows, pDst, i, count);
+}
+
+template <typename K>
+__attribute__((target("avx2")))
+static void StaticRowAvx2(const float *pSrc, int channel, float *pDst, int count)
+{
+    const float *pTap = pSrc - K::center*channel;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 sum = _mm256_setzero_ps();
+#pragma GCC unroll 16
+        for (int k = 0; k < K::size; ++k) {
+            if (K::taps[k] != 0.0f)
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(pTap + i + k*channel), _mm256_set1_ps(K::taps[k])));
+        }
+        _mm256_storeu_ps(pDst + i, sum);
+    }
+    _mm256_zeroupper();
+    StaticRowScalar<K>(pSrc, channel, pDst, i, count);
+}
+
+template <typename K, typename T>
+__attribute__((target("avx512f")))
+static void StaticColumnsAvx512(const T * const *ppRows, float *pDst, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 sum = _mm512_setzero_ps();
+#pragma GCC unroll 16
+        for (int k = 0; k < K::size; ++k) {
+            if (K::taps[k] != 0.0f)
+                sum = MUL_ADD_512(sum, Load16(ppRows[k] + i), _mm512_set1_ps(K::taps[k]));
+        }
+        _mm512_storeu_ps(pDst + i, sum);
+    }
+    _mm256_zeroupper();
+    StaticColumnsScalar<K>(ppRows, pDst, i, count);
+}
+
+template <typename K>
+__attribute__((target("avx512f")))
+static void StaticRowAvx512(const float *pSrc, int channel, float *pDst, int count)
+{
+    const float *pTap = pSrc - K::center*channel;
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 sum = _mm512_setzero_ps();
+#pragma GCC unroll 16
+        for (int k = 0; k < K::size; ++k) {
+            if (K::taps[k] != 0.0f)
+                sum = MUL_ADD_512(sum, _mm512_loadu_ps(pTap + i + k*channel), _mm512_set1_ps(K::taps[k]));
+        }
+        _mm512_storeu_ps(pDst + i, sum);
+    }
+    _mm256_zeroupper();
+    StaticRowScalar<K>(pSrc, channel, pDst, i, count);
+}
+
+#undef MUL_ADD_512
+
+// fixed point, AVX2: 16 int16 or 8 int32 lanes
+__attribute__((target("avx2")))
+static void SobelColumnsFixedAvx2(const unsigned char * const *ppRows, short *pFx, short *pFy, int count)
+{
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i r0 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ppRows[0] + i)));
+        __m256i r1 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ppRows[1] + i)));
+        __m256i r2 = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ppRows[2] + i)));
+        __m256i fx = _mm256_add_epi16(_mm256_add_epi16(r0, r2), _mm256_slli_epi16(r1, 1));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pFx + i), fx);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pFy + i), _mm256_sub_epi16(r2, r0));
+    }
+    _mm256_zeroupper();
+    SobelColumnsFixedScalar(ppRows, pFx, pFy, i, count);
+}
+
+// the 32-bit products of 16 int16 lanes, from their low and high halves, in pixel order
+__attribute__((target("avx2")))
+static inline void StoreProducts(__m256i a, __m256i b, int *pDst)
+{
+    __m256i low = _mm256_mullo_epi16(a, b);
+    __m256i high = _mm256_mulhi_epi16(a, b);
+    __m256i p0 = _mm256_unpacklo_epi16(low, high);  // pixels 0-3 and 8-11
+    __m256i p1 = _mm256_unpackhi_epi16(low, high);  // pixels 4-7 and 12-15
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst), _mm256_permute2x128_si256(p0, p1, 0x20));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + 8), _mm256_permute2x128_si256(p0, p1, 0x31));
+}
+
+__attribute__((target("avx2")))
+static void SobelTensorFixedAvx2(const short *pFx, const short *pFy, int *pXX, int *pXY, int *pYY, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i dx = _mm256_sub_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pFx + x + 1)),
+                                      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pFx + x - 1)));
+        __m256i dy = _mm256_add_epi16(_mm256_add_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pFy + x - 1)),
+                                                       _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pFy + x + 1))),
+                                      _mm256_slli_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(pFy + x)), 1));
+        StoreProducts(dx, dx, pXX + x);
+        StoreProducts(dx, dy, pXY + x);
+        StoreProducts(dy, dy, pYY + x);
+    }
+    _mm256_zeroupper();
+    SobelTensorFixedScalar(pFx, pFy, pXX, pXY, pYY, x, width);
+}
+
+template <typename Taps>
+__attribute__((target("avx2")))
+static void FixedAvx2(Taps taps, const int *pKernel, int size, int shift, int *pDst, int count)
+{
+    int half = size / 2;
+    __m256i round = _mm256_set1_epi32(1 << (shift - 1));
+    __m128i count64 = _mm_cvtsi32_si128(shift);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i sum = _mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(taps(half) + i)),
+                                         _mm256_set1_epi32(pKernel[half]));
+        for (int k = 0; k < half; ++k) {
+            __m256i pair = _mm256_add_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(taps(k) + i)),
+                                            _mm256_loadu_si256(reinterpret_cast<const __m256i*>(taps(size-1-k) + i)));
+            sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(pair, _mm256_set1_epi32(pKernel[k])));
+        }
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(pDst + i), _mm256_sra_epi32(_mm256_add_epi32(sum, round), count64));
+    }
+    _mm256_zeroupper();
+    FixedScalar(taps, pKernel, size, shift, pDst, i, count);
+}
+
+// fixed point, AVX-512: 16 int32 lanes for the blur, the int16 Sobel stays on AVX2 (it would need avx512bw)
+template <typename Taps>
+__attribute__((target("avx512f")))
+static void FixedAvx512(Taps taps, const int *pKernel, int size, int shift, int *pDst, int count)
+{
+    int half = size / 2;
+    __m512i round = _mm512_set1_epi32(1 << (shift - 1));
+    __m128i count64 = _mm_cvtsi32_si128(shift);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i sum = _mm512_mullo_epi32(_mm512_loadu_si512(taps(half) + i), _mm512_set1_epi32(pKernel[half]));
+        for (int k = 0; k < half; ++k) {
+            __m512i pair = _mm512_add_epi32(_mm512_loadu_si512(taps(k) + i), _mm512_loadu_si512(taps(size-1-k) + i));
+            sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(pair, _mm512_set1_epi32(pKernel[k])));
+        }
+        _mm512_storeu_si512(pDst + i, _mm512_maskz_sra_epi32(0xFFFF, _mm512_add_epi32(sum, round), count64));
+    }
+    _mm256_zeroupper();
+    FixedScalar(taps, pKernel, size, shift, pDst, i, count);
+}
+
+__attribute__((target("sse4.1")))
+static void MinMaxSse41(const float *pSrc, int count, float &min, float &max)
+{
+    __m128 vMin = _mm_set1_ps(min);
+    __m128 vMax = _mm_set1_ps(max);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 value = _mm_loadu_ps(pSrc + i);
+        vMin = _mm_min_ps(value, vMin);
+        vMax = _mm_max_ps(value, vMax);
+    }
+    float minLanes[4], maxLanes[4];
+    _mm_storeu_ps(minLanes, vMin);
+    _mm_storeu_ps(maxLanes, vMax);
+    MinMaxLanes(minLanes, maxLanes, 4, min, max);
+    MinMaxScalar(pSrc, i, count, min, max);
+}
+
+// two accumulators each, so the 4-cycle min/max latency does not bound the loop
+__attribute__((target("avx2")))
+static void MinMaxAvx2(const float *pSrc, int count, float &min, float &max)
+{
+    __m256 vMin0 = _mm256_set1_ps(min), vMin1 = vMin0;
+    __m256 vMax0 = _mm256_set1_ps(max), vMax1 = vMax0;
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256 value0 = _mm256_loadu_ps(pSrc + i);
+        __m256 value1 = _mm256_loadu_ps(pSrc + i + 8);
+        vMin0 = _mm256_min_ps(value0, vMin0);
+        vMax0 = _mm256_max_ps(value0, vMax0);
+        vMin1 = _mm256_min_ps(value1, vMin1);
+        vMax1 = _mm256_max_ps(value1, vMax1);
+    }
+    float minLanes[8], maxLanes[8];
+    _mm256_storeu_ps(minLanes, _mm256_min_ps(vMin0, vMin1));
+    _mm256_storeu_ps(maxLanes, _mm256_max_ps(vMax0, vMax1));
+    _mm256_zeroupper();
+    MinMaxLanes(minLanes, maxLanes, 8, min, max);
+    MinMaxScalar(pSrc, i, count, min, max);
+}
+
+__attribute__((target("avx512f")))
+static void MinMaxAvx512(const float *pSrc, int count, float &min, float &max)
+{
+    __m512 vMin0 = _mm512_set1_ps(min), vMin1 = vMin0;
+    __m512 vMax0 = _mm512_set1_ps(max), vMax1 = vMax0;
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m512 value0 = _mm512_loadu_ps(pSrc + i);
+        __m512 value1 = _mm512_loadu_ps(pSrc + i + 16);
+        vMin0 = _mm512_maskz_min_ps(0xFFFF, value0, vMin0);
+        vMax0 = _mm512_maskz_max_ps(0xFFFF, value0, vMax0);
+        vMin1 = _mm512_maskz_min_ps(0xFFFF, value1, vMin1);
+        vMax1 = _mm512_maskz_max_ps(0xFFFF, value1, vMax1);
+    }
+    float minLanes[16], maxLanes[16];
+    _mm512_storeu_ps(minLanes, _mm512_maskz_min_ps(0xFFFF, vMin0, vMin1));
+    _mm512_storeu_ps(maxLanes, _mm512_maskz_max_ps(0xFFFF, vMax0, vMax1));
+    _mm256_zeroupper();
+    MinMaxLanes(minLanes, maxLanes, 16, min, max);
+    MinMaxScalar(pSrc, i, count, min, max);
+}
+
+#endif // CONVOLVE_X86
+
+static SimdLevel DetectSimdLevel()
+{
+#if CONVOLVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SimdLevel::SSE41;
+#endif
+    return SimdLevel::SCALAR;
+}
+
+static std::atomic<int> &CurrentLevel()
+{
+    static std::atomic<int> level((int)DetectSimdLevel());
+    return level;
+}
+
+SimdLevel GetSimdLevel()
+{
+    return (SimdLevel)CurrentLevel().load(std::memory_order_relaxed);
+}
+
+void SetSimdLevel(SimdLevel level)
+{
+    SimdLevel supported = DetectSimdLevel();
+    if ((int)level > (int)supported)
+        level = supported;
+    CurrentLevel().store((int)level, std::memory_order_relaxed);
+}
+
+void ConvolveColumns(const float * const *ppRows, const float *pKernel, int size, float *pDst, int count)
+{
+    switch (GetSimdLevel())
+    {
+#if CONVOLVE_X86
+    case SimdLevel::AVX512:
+        ColumnsAvx512(ppRows, pKernel, size, pDst, count);
+        break;
+    case SimdLevel::AVX2:
+        ColumnsAvx2(ppRows, pKernel, size, pDst, count);
+        break;
+    case SimdLevel::SSE41:
+        ColumnsSse41(ppRows, pKernel, size, pDst, count);
+        break;
+#endif
+    case SimdLevel::SCALAR:
+    default:
+        ColumnsScalar(ppRows, pKernel, size, pDst, 0, count);
+        break;
+    }
+}
+
+void ConvolveColumns(const unsigned char * const *ppRows, const float *pKernel, int size, float *pDst, int count)
+{
+    switch (GetSimdLevel())
+    {
+#if CONVOLVE_X86
+    case SimdLevel::AVX512:
+        ColumnsAvx512(ppRows, pKernel, size, pDst, count);
+        break;
+    case SimdLevel::AVX2:
+        ColumnsAvx2(ppRows, pKernel, size, pDst, count);
+        break;
+    case SimdLevel::SSE41:
+        ColumnsSse41(ppRows, pKernel, size, pDst, count);
+        break;
+#endif
+    case SimdLevel::SCALAR:
+    default:
+        ColumnsScalar(ppRows, pKernel, size, pDst, 0, count);
+        break;
+    }
+}
+
+void ConvolveColumns(const unsigned short * const *ppRows, const float *pKernel, int size, float *pDst, int count)
+{
+    // 16-bit sources are rare, the scalar loop is left to the compiler
+    ColumnsScalar(ppRows, pKernel, size, pDst, 0, count);
+}
+
+void ConvolveRow(const float *pSrc, int channel, const float *pKernel, int size, int center, float *pDst, int count)
+{
+    switch (GetSimdLevel())
+    {
+#if CONVOLVE_X86
+    case SimdLevel::AVX512:
+        RowAvx512(pSrc, channel, pKernel, size, center, pDst, count);
+        break;
+    case SimdLevel::AVX2:
+        RowAvx2(pSrc, channel, pKernel, size, center, pDst, count);
+        break;
+    case SimdLevel::SSE41:
+        RowSse41(pSrc, channel, pKernel, size, center, pDst, count);
+        break;
+#endif
+    case SimdLevel::SCALAR:
+    default:
+        RowScalar(pSrc, channel, pKernel, size, center, pDst, 0, count);
+        break;
+    }
+}
+
+template <typename K, typename T>
+static void StaticColumns(const T * const *ppRows, float *pDst, int count)
+{
+    switch (GetSimdLevel())
+    {
+#if CONVOLVE_X86
+    case SimdLevel::AVX512:
+        StaticColumnsAvx512<K>(ppRows, pDst, count);
+        break;
+    case SimdLevel::AVX2:
+        StaticColumnsAvx2<K>(ppRows, pDst, count);
+        break;
+    case SimdLevel::SSE41:
+        StaticColumnsSse41<K>(ppRows, pDst, count);
+        break;
+#endif
+    case SimdLevel::SCALAR:
+    default:
+        StaticColumnsScalar<K>(ppRows, pDst, 0, count);
+        break;
+    }
+}
+
+template <typename K>
+void ConvolveColumns(const float * const *ppRows, float *pDst, int count)
+{
+    StaticColumns<K>(ppRows, pDst, count);
+}
+
+template <typename K>
+void ConvolveColumns(const unsigned char * const *ppRows, float *pDst, int count)
+{
+    StaticColumns<K>(ppRows, pDst, count);
+}
+
+template <typename K>
+void ConvolveColumns(const unsigned short * const *ppRows, float *pDst, int count)
+{
+    StaticColumnsScalar<K>(ppRows, pDst, 0, count);
+}
+
+template <typename K>
+void ConvolveRow(const float *pSrc, int channel, float *pDst, int count)
+{
+    switch (GetSimdLevel())
+    {
+#if CONVOLVE_X86
+    case SimdLevel::AVX512:
+        StaticRowAvx512<K>(pSrc, channel, pDst, count);
+        break;
+    case SimdLevel::AVX2:
+        StaticRowAvx2<K>(pSrc, channel, pDst, count);
+        break;
+    case SimdLevel::SSE41:
+        StaticRowSse41<K>(pSrc, channel, pDst, count);
+        break;
+#endif
+    case SimdLevel::SCALAR:
+    default:
+        StaticRowScalar<K>(pSrc, channel, pDst, 0, count);
+        break;
+    }
+}
+
+// the static kernels of convolve.hpp, a new one is added here too
+#define INSTANTIATE_STATIC_KERNEL(K) \
+    template void ConvolveColumns<K>(const float * const *ppRows, float *pDst, int count); \
+    template void ConvolveColumns<K>(const unsigned char * const *ppRows, float *pDst, int count); \
+    template void ConvolveColumns<K>(const unsigned short * const *ppRows, float *pDst, int count); \
+    template void ConvolveRow<K>(const float *pSrc, int channel, float *pDst, int count);
+
+INSTANTIATE_STATIC_KERNEL(SobelSmooth)
+INSTANTIATE_STATIC_KERNEL(ScharrSmooth)
+INSTANTIATE_STATIC_KERNEL(CentralDifference)
+INSTANTIATE_STATIC_KERNEL(Binomial5)
+
+#undef INSTANTIATE_STATIC_KERNEL
+
+void QuantizeKernel(const float *pKernel, int size, int *pFixed)
+{
+    int one = 1 << FixedKernelShift;
+    int center = size / 2;
+    int sum = 0;
+    for (int k = 0; k < size; ++k) {
+        pFixed[k] = (int)floor(pKernel[k] * one);
+        sum += pFixed[k];
+    }
+
+    // the units rounded off go back to the mirrored pairs with the largest remainders, an odd
+    // one to the center, so the kernel stays symmetric and no tap is off by more than one unit
+    int left = one - sum;
+    while (left >= 2) {
+        int best = -1;
+        float bestRest = -1.0f;
+        for (int k = 0; k < center; ++k) {
+            float rest = pKernel[k] * one - pFixed[k];
+            if (rest > bestRest) {
+                best = k;
+                bestRest = rest;
+            }
+        }
+        if (best < 0)
+            break;
+        ++pFixed[best];
+        ++pFixed[size-1-best];
+        left -= 2;
+    }
+    pFixed[center] += left;
+}
+
+// the fixed-point Sobel runs AVX2 on AVX512 and AVX2, the scalar loop below
+static bool UseFixedAvx2()
+{
+    SimdLevel level = GetSimdLevel();
+    return CONVOLVE_X86 && (level == SimdLevel::AVX2 || level == SimdLevel::AVX512);
+}
+
+void SobelColumnsFixed(const unsigned char * const *ppRows, short *pFx, short *pFy, int count)
+{
+#if CONVOLVE_X86
+    if (UseFixedAvx2()) {
+        SobelColumnsFixedAvx2(ppRows, pFx, pFy, count);
+        return;
+    }
+#endif
+    SobelColumnsFixedScalar(ppRows, pFx, pFy, 0, count);
+}
+
+void SobelTensorFixed(const short *pFx, const short *pFy, int *pXX, int *pXY, int *pYY, int width)
+{
+#if CONVOLVE_X86
+    if (UseFixedAvx2()) {
+        SobelTensorFixedAvx2(pFx, pFy, pXX, pXY, pYY, width);
+        return;
+    }
+#endif
+    SobelTensorFixedScalar(pFx, pFy, pXX, pXY, pYY, 0, width);
+}
+
+void ConvolveColumnsFixed(const int * const *ppRows, const int *pKernel, int size, int shift, int *pDst, int count)
+{
+    ColumnTaps taps = {ppRows};
+#if CONVOLVE_X86
+    if (GetSimdLevel() == SimdLevel::AVX512) {
+        FixedAvx512(taps, pKernel, size, shift, pDst, count);
+        return;
+    }
+    if (UseFixedAvx2()) {
+        FixedAvx2(taps, pKernel, size, shift, pDst, count);
+        return;
+    }
+#endif
+    FixedScalar(taps, pKernel, size, shift, pDst, 0, count);
+}
+
+void ConvolveRowFixed(const int *pSrc, const int *pKernel, int size, int center, int shift, int *pDst, int count)
+{
+    RowTaps taps = {pSrc - center};
+#if CONVOLVE_X86
+    if (GetSimdLevel() == SimdLevel::AVX512) {
+        FixedAvx512(taps, pKernel, size, shift, pDst, count);
+        return;
+    }
+    if (UseFixedAvx2()) {
+        FixedAvx2(taps, pKernel, size, shift, pDst, count);
+        return;
+    }
+#endif
+    FixedScalar(taps, pKernel, size, shift, pDst, 0, count);
+}
+
+void MinMaxElements(const float *pSrc, int count, float &min, float &max)
+{
+    switch (GetSimdLevel())
+    {
+#if CONVOLVE_X86
+    case SimdLevel::AVX512:
+        MinMaxAvx512(pSrc, count, min, max);
+        break;
+    case SimdLevel::AVX2:
+        MinMaxAvx2(pSrc, count, min, max);
+        break;
+    case SimdLevel::SSE41:
+        MinMaxSse41(pSrc, count, min, max);
+        break;
+#endif
+    case SimdLevel::SCALAR:
+    default:
+        MinMaxScalar(pSrc, 0, count, min, max);
+        break;
+    }
+}
+
+}
@@ -0,0 +1,110 @@
+#ifndef __CONVOLVE_HPP__
+#define __CONVOLVE_HPP__
+
+namespace shun {
+
+    // instruction sets of the 1D convolution passes, picked at runtime from the CPU flags
+    enum class SimdLevel : int {
+        SCALAR = 0,
+        SSE41,
+        AVX2,
+        AVX512,
+    };
+
+    // the best level supported by this CPU, capped by SetSimdLevel()
+    SimdLevel GetSimdLevel();
+    // cap the level, e.g. SCALAR to compare against the reference path.
+    // A level the CPU does not support falls back to the best one it does.
+    void SetSimdLevel(SimdLevel level);
+
+    // The vector paths use a separate multiply and add per tap, in the same tap
+    // order as the scalar path, so every level gives bit-identical results
+    // (tolerance 0 ULP). No FMA contraction is used on purpose.
+
+    // vertical pass: pDst[i] = sum_k ppRows[k][i] * pKernel[k], i in [0, count)
+    void ConvolveColumns(const float * const *ppRows, const float *pKernel, int size, float *pDst, int count);
+    void ConvolveColumns(const unsigned char * const *ppRows, const float *pKernel, int size, float *pDst, int count);
+    void ConvolveColumns(const unsigned short * const *ppRows, const float *pKernel, int size, float *pDst, int count);
+
+    // horizontal pass over interleaved pixels: pDst[i] = sum_k pSrc[i+(k-center)*channel] * pKernel[k],
+    // pSrc must be padded with at least center replicated pixels on both sides
+    void ConvolveRow(const float *pSrc, int channel, const float *pKernel, int size, int center, float *pDst, int count);
+
+    // A kernel whose taps are compile-time constants, Taps / Divisor. The passes below are unrolled
+    // for it and skip its zero taps, on finite input they equal the runtime passes with the same taps.
+    // They are instantiated in convolve.cpp for the kernels that follow.
+    template <int Divisor, int... Taps>
+    struct StaticKernel {
+        static const int size = sizeof...(Taps);
+        static const int center = sizeof...(Taps) / 2;
+        static constexpr float taps[sizeof...(Taps)] = {(float)Taps / Divisor...};
+    };
+
+    template <int Divisor, int... Taps>
+    constexpr float StaticKernel<Divisor, Taps...>::taps[];
+
+    typedef StaticKernel<1, 1, 2, 1> SobelSmooth;
+    typedef StaticKernel<1, 3, 10, 3> ScharrSmooth;
+    typedef StaticKernel<1, -1, 0, 1> CentralDifference;     // the derivative of Sobel and Scharr
+    typedef StaticKernel<16, 1, 4, 6, 4, 1> Binomial5;
+
+    template <typename K>
+    void ConvolveColumns(const float * const *ppRows, float *pDst, int count);
+    template <typename K>
+    void ConvolveColumns(const unsigned char * const *ppRows, float *pDst, int count);
+    template <typename K>
+    void ConvolveColumns(const unsigned short * const *ppRows, float *pDst, int count);
+    template <typename K>
+    void ConvolveRow(const float *pSrc, int channel, float *pDst, int count);
+
+    // Fixed-point passes of the 8-bit Harris path. The arithmetic is exact, so all levels give the
+    // same result. The blur has AVX512, AVX2 and scalar versions, the Sobel AVX2 and scalar ones.
+    static const int FixedKernelShift = 10;     // Q10 kernel weights, they sum to 1 << 10
+
+    // round a normalized symmetric float kernel to Q10 taps summing to 1 << 10, each within one unit
+    void QuantizeKernel(const float *pKernel, int size, int *pFixed);
+    // vertical Sobel pass over 3 gray rows, 16 lanes per AVX2 register: pFx = r0 + 2*r1 + r2, pFy = r2 - r0
+    void SobelColumnsFixed(const unsigned char * const *ppRows, short *pFx, short *pFy, int count);
+    // horizontal Sobel pass and structure tensor: dx = pFx[x+1] - pFx[x-1], dy = pFy[x-1] + 2*pFy[x] + pFy[x+1],
+    // planar pXX = dx*dx, pXY = dx*dy, pYY = dy*dy. pFx and pFy are padded by 1 pixel on both sides.
+    void SobelTensorFixed(const short *pFx, const short *pFy, int *pXX, int *pXY, int *pYY, int width);
+    // pDst[i] = round(sum_k ppRows[k][i] * pKernel[k] / 2^shift) for a symmetric kernel, the mirrored
+    // taps are added first. Values below 2^20 with Q10 weights summing to 2^10 cannot overflow.
+    void ConvolveColumnsFixed(const int * const *ppRows, const int *pKernel, int size, int shift, int *pDst, int count);
+    // the same along a single-channel row padded by center pixels on both sides
+    void ConvolveRowFixed(const int *pSrc, const int *pKernel, int size, int center, int shift, int *pDst, int count);
+
+    // min and max of pSrc[0, count) folded into min and max, NaNs are skipped. The comparisons are
+    // exact, so all levels give the same result.
+    void MinMaxElements(const float *pSrc, int count, float &min, float &max);
+
+    // copy the first and the last pixel of a row into the border pixels on its left and right
+    template <typename T>
+    inline void ReplicateRowEdges(T *pRow, int width, int channel, int border)
+    {
+        for (int x = 1; x <= border; ++x) {
+            for (int c = 0; c < channel; ++c) {
+                pRow[-x*channel + c] = pRow[c];
+                pRow[(width-1+x)*channel + c] = pRow[(width-1)*channel + c];
+            }
+        }
+    }
+
+    // the same for a row with left and right real pixels beyond its edges, only the
+    // positions past them are replicated
+    template <typename T>
+    inline void ReplicateRowEdges(T *pRow, int width, int channel, int border, int left, int right)
+    {
+        for (int x = left + 1; x <= border; ++x) {
+            for (int c = 0; c < channel; ++c)
+                pRow[-x*channel + c] = pRow[-left*channel + c];
+        }
+        for (int x = right + 1; x <= border; ++x) {
+            for (int c = 0; c < channel; ++c)
+                pRow[(width-1+x)*channel + c] = pRow[(width-1+right)*channel + c];
+        }
+    }
+
+}
+
+#endif // __CONVOLVE_HPP__
@@ -1,45 +1,245 @@
 #include "image.hpp"
+#include "convolve.hpp"
+#include "threadPool.hpp"
+#include "profiler.hpp"
 #include <iostream>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cstddef>
 #include <cmath>
+#include <csetjmp>
 #include <limits>
+#include <new>
+#include <vector>
+#include <algorithm>
 #include <jpeglib.h>
 #include <jerror.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 namespace shun {
 
 using namespace std;
 
+// the filters are split into bands of at least this many rows across the shared thread pool
+static const int rowGrain = 16;
+
+template <typename S, typename D>
+static void ConvertElements(const S *pSrc, D *pDst, size_t count, float alpha, float beta)
+{
+    if (alpha == 1.0f && beta == 0.0f) {
+        for (size_t i = 0; i < count; ++i)
+            pDst[i] = SaturateCast<D>((float)pSrc[i]);
+    } else {
+        for (size_t i = 0; i < count; ++i)
+            pDst[i] = SaturateCast<D>((float)pSrc[i] * alpha + beta);
+    }
+}
+
+template <typename S>
+static void ConvertElements(const S *pSrc, void *pDst, ImageType dstType, size_t count, float alpha, float beta)
+{
+    switch (dstType)
+    {
+    case ImageType::UINT8:
+        ConvertElements(pSrc, static_cast<unsigned char*>(pDst), count, alpha, beta);
+        break;
+    case ImageType::UINT16:
+        ConvertElements(pSrc, static_cast<unsigned short*>(pDst), count, alpha, beta);
+        break;
+    case ImageType::FLOAT32:
+    default:
+        ConvertElements(pSrc, static_cast<float*>(pDst), count, alpha, beta);
+        break;
+    }
+}
+
+// convert count elements between any two storage types
+static void ConvertElements(const void *pSrc, ImageType srcType, void *pDst, ImageType dstType, size_t count, float alpha, float beta)
+{
+    switch (srcType)
+    {
+    case ImageType::UINT8:
+        ConvertElements(static_cast<const unsigned char*>(pSrc), pDst, dstType, count, alpha, beta);
+        break;
+    case ImageType::UINT16:
+        ConvertElements(static_cast<const unsigned short*>(pSrc), pDst, dstType, count, alpha, beta);
+        break;
+    case ImageType::FLOAT32:
+    default:
+        ConvertElements(static_cast<const float*>(pSrc), pDst, dstType, count, alpha, beta);
+        break;
+    }
+}
+
+int Image::ElemSize(ImageType type)
+{
+    switch (type)
+    {
+    case ImageType::UINT8:
+        return sizeof(unsigned char);
+    case ImageType::UINT16:
+        return sizeof(unsigned short);
+    case ImageType::FLOAT32:
+    default:
+        return sizeof(float);
+    }
+}
+
 Image::Image()
 {
     Init();
 }
 
-Image::Image(int width, int height, int channel)
+Image::Image(int width, int height, int channel, ImageType type)
 {
     Init();
-    Allocate(width, height, channel, 0);
+    Allocate(width, height, channel, type, 0);
 }
 
 Image::Image(const Image &rhs)
 {
     Init();
-    if (CVError::NOERROR == Allocate(rhs.mWidth, rhs.mHeight, rhs.mChannel, 0)) {
+    CopyPixels(rhs);
+}
+
+// the pixels of src into dst of the same size and layout, row by row and plane by plane
+static void CopyRows(const Image &src, Image &dst)
+{
+    int planes = src.IsPlanar() ? src.GetChannel() : 1;
+    size_t bytes = (size_t)src.GetWidth() * (src.GetChannel() / planes) * src.GetElemSize();
+    size_t srcPlane = src.GetPlaneStride() * src.GetElemSize();
+    size_t dstPlane = dst.GetPlaneStride() * dst.GetElemSize();
+    for (int p = 0; p < planes; ++p) {
+        for (int y = 0; y < src.GetHeight(); ++y)
+            memcpy(static_cast<unsigned char*>(dst.GetRowData(y)) + p * dstPlane,
+                   static_cast<const unsigned char*>(src.GetRowData(y)) + p * srcPlane, bytes);
+    }
+}
+
+// an image owning its pixels is shared unless it has had a view taken, then it is copied like
+// a view, row by row into a compact image. Copying into a view of the same geometry writes through it.
+void Image::CopyPixels(const Image &rhs)
+{
+    if (rhs.IsEmpty()) {
+        Release();
+        return;
+    }
+
+    // the reference is taken before the pin is checked, see PinForView()
+    ImageBufferHeader *pHeader = static_cast<ImageBufferHeader*>(rhs.mBuffer);
+    bool share = !rhs.IsView() && !IsView();
+    if (share) {
+        pHeader->mRefCount.fetch_add(1);
+        if (pHeader->mPinned.load()) {
+            pHeader->mRefCount.fetch_sub(1, std::memory_order_relaxed);
+            share = false;
+        }
+    }
+
+    if (share) {
+        // this image may share the buffer already, the reference above keeps it
+        Release();
+        mChannel = rhs.mChannel;
+        mBuffer = rhs.mBuffer;
+        mBufferBytes = rhs.mBufferBytes;
+        mData = rhs.mData;
         mDebug = rhs.mDebug;
-        memcpy(mData, rhs.mData, mSize*sizeof(float));
+        mHeight = rhs.mHeight;
+        mSize = rhs.mSize;
+        mStride = rhs.mStride;
+        mBorder = rhs.mBorder;
+        mType = rhs.mType;
+        mLayout = rhs.mLayout;
+        mPlaneStride = rhs.mPlaneStride;
+        mWidth = rhs.mWidth;
+        return;
+    }
+
+    int border = rhs.IsView() ? 0 : rhs.mBorder;
+    if (CVError::NOERROR == AllocateBuffer(rhs.mWidth, rhs.mHeight, rhs.mChannel, border, rhs.mType, 1, rhs.mLayout)) {
+        mDebug = rhs.mDebug;
+        CopyRows(rhs, *this);
     }
 }
 
+CVError Image::Detach()
+{
+    CVError status = CVError::NOERROR;
+    if (!IsShared())
+        return status;
+
+    // a shared view becomes a compact copy
+    if (IsView()) {
+        Image copy;
+        copy.mpAllocator = mpAllocator;
+        copy.CopyPixels(*this);
+        *this = std::move(copy);
+        if (IsEmpty()) {
+            status = CVError::MEMORY;
+            SHOW_ERROR_AND_RETURN(status);
+        }
+        return status;
+    }
+
+    size_t bytes = BufferHeaderBytes + GetBufferBytes();
+    void *pBuffer = mpAllocator->Allocate(bytes);
+    if (Profiler::IsEnabled())
+        Profiler::CountAllocation(bytes);
+    if (pBuffer == nullptr) {
+        Release();
+        status = CVError::MEMORY;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    ImageBufferHeader *pHeader = new (pBuffer) ImageBufferHeader;
+    pHeader->mRefCount.store(1, std::memory_order_relaxed);
+    pHeader->mPinned.store(0, std::memory_order_relaxed);
+    pHeader->mBytes = bytes;
+    pHeader->mpAllocator = mpAllocator;
+
+    // the border is copied too, pixel (0, 0) keeps its offset
+    size_t offset = static_cast<unsigned char*>(mData) - static_cast<unsigned char*>(mBuffer);
+    memcpy(static_cast<unsigned char*>(pBuffer) + BufferHeaderBytes,
+           static_cast<unsigned char*>(mBuffer) + BufferHeaderBytes, GetBufferBytes());
+
+    // the other images may have released theirs meanwhile
+    ImageBufferHeader *pShared = static_cast<ImageBufferHeader*>(mBuffer);
+    if (pShared->mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        pShared->mpAllocator->Free(mBuffer, pShared->mBytes);
+
+    mBuffer = pBuffer;
+    mBufferBytes = bytes;
+    mData = static_cast<unsigned char*>(pBuffer) + offset;
+
+    return status;
+}
+
 Image::Image(Image &&rhs)
 {
     mChannel = rhs.mChannel;
+    mBuffer = rhs.mBuffer;
+    mBufferBytes = rhs.mBufferBytes;
+    mpAllocator = rhs.mpAllocator;
     mData = rhs.mData;
     mDebug = rhs.mDebug;
     mHeight = rhs.mHeight;
     mSize = rhs.mSize;
+    mStride = rhs.mStride;
+    mBorder = rhs.mBorder;
+    mMarginLeft = rhs.mMarginLeft;
+    mMarginTop = rhs.mMarginTop;
+    mMarginRight = rhs.mMarginRight;
+    mMarginBottom = rhs.mMarginBottom;
+    mSharedView = rhs.mSharedView;
+    mType = rhs.mType;
+    mLayout = rhs.mLayout;
+    mPlaneStride = rhs.mPlaneStride;
     mWidth = rhs.mWidth;
+    rhs.mBuffer = nullptr;
     rhs.mData = nullptr;
 }
 
@@ -50,24 +250,39 @@ Image::~Image()
 
 Image& Image::operator=(const Image &rhs)
 {
-    if (this != &rhs) {
-        if (CVError::NOERROR == Allocate(rhs.mWidth, rhs.mHeight, rhs.mChannel)) {
-            mDebug = rhs.mDebug;
-            memcpy(mData, rhs.mData, mSize*sizeof(float));
-        }
-    }
+    if (this != &rhs)
+        CopyPixels(rhs);
 
     return *this;
 }
 
 Image& Image::operator=(Image &&rhs)
 {
+    if (this == &rhs)
+        return *this;
+
+    // the buffer goes back to the allocator it came from, so the allocator moves with it
+    Release();
     mChannel = rhs.mChannel;
+    mBuffer = rhs.mBuffer;
+    mBufferBytes = rhs.mBufferBytes;
+    mpAllocator = rhs.mpAllocator;
     mData = rhs.mData;
     mDebug = rhs.mDebug;
     mHeight = rhs.mHeight;
     mSize = rhs.mSize;
+    mStride = rhs.mStride;
+    mBorder = rhs.mBorder;
+    mMarginLeft = rhs.mMarginLeft;
+    mMarginTop = rhs.mMarginTop;
+    mMarginRight = rhs.mMarginRight;
+    mMarginBottom = rhs.mMarginBottom;
+    mSharedView = rhs.mSharedView;
+    mType = rhs.mType;
+    mLayout = rhs.mLayout;
+    mPlaneStride = rhs.mPlaneStride;
     mWidth = rhs.mWidth;
+    rhs.mBuffer = nullptr;
     rhs.mData = nullptr;
 
     return *this;
@@ -79,29 +294,97 @@ void Image::Init()
     mHeight = 0;
     mChannel = 0;
     mSize = 0;
+    mStride = 0;
+    mBorder = 0;
+    mMarginLeft = mMarginTop = mMarginRight = mMarginBottom = 0;
     mDebug = 0;
+    mSharedView = 0;
+    mType = ImageType::FLOAT32;
+    mLayout = ImageLayout::INTERLEAVED;
+    mPlaneStride = 0;
+    mBuffer = nullptr;
     mData = nullptr;
+    mBufferBytes = 0;
+    mpAllocator = &ImageAllocator::Default();
 }
 
-CVError Image::Allocate(int width, int height, int channel, int freeMemory)
+void Image::SetAllocator(ImageAllocator *pAllocator)
+{
+    if (pAllocator == nullptr)
+        pAllocator = &ImageAllocator::Default();
+    if (pAllocator != mpAllocator) {
+        Release();
+        mpAllocator = pAllocator;
+    }
+}
+
+CVError Image::Allocate(int width, int height, int channel, ImageType type, int freeMemory)
+{
+    return AllocateBuffer(width, height, channel, 0, type, freeMemory);
+}
+
+CVError Image::AllocatePadded(int width, int height, int channel, int border, ImageType type)
+{
+    return AllocateBuffer(width, height, channel, border, type, 1);
+}
+
+CVError Image::AllocatePlanar(int width, int height, int channel, ImageType type)
+{
+    return AllocateBuffer(width, height, channel, 0, type, 1, ImageLayout::PLANAR);
+}
+
+CVError Image::AllocateBuffer(int width, int height, int channel, int border, ImageType type, int freeMemory, ImageLayout layout)
 {
     CVError status = CVError::NOERROR;
 
-    if (width <= 0 || height <= 0 || channel <= 0) {
+    if (width <= 0 || height <= 0 || channel <= 0 || border < 0) {
         status = CVError::INPUT;
         SHOW_ERROR_AND_RETURN(status);
     }
 
-    if (freeMemory)
-        Release();
+    // a view of the same geometry is written through, unless it is a view of a shared image
+    if (IsView() && !mSharedView && width == mWidth && height == mHeight && channel == mChannel && type == mType && border == 0 &&
+        (layout == mLayout || channel == 1))
+        return status;
+
+    bool planar = (layout == ImageLayout::PLANAR);
+    int stride = (width + 2*border) * (planar ? 1 : channel);
+    size_t planeStride = planar ? (size_t)stride * (height + 2*border) : 0;
+    size_t bytes = BufferHeaderBytes + (size_t)stride * (height + 2*border) * (planar ? channel : 1) * ElemSize(type);
 
-    mData = new float [width * height * channel];
-    if (mData) {
+    // keep the current buffer if it is big enough, not much bigger and not shared
+    if (freeMemory && mBuffer && bytes <= mBufferBytes && bytes >= mBufferBytes / 2 && !IsShared()) {
+        bytes = mBufferBytes;
+    } else {
+        if (freeMemory)
+            Release();
+        mBuffer = mpAllocator->Allocate(bytes);
+        if (Profiler::IsEnabled())
+            Profiler::CountAllocation(bytes);
+        if (mBuffer) {
+            ImageBufferHeader *pHeader = new (mBuffer) ImageBufferHeader;
+            pHeader->mRefCount.store(1, std::memory_order_relaxed);
+            pHeader->mPinned.store(0, std::memory_order_relaxed);
+            pHeader->mBytes = bytes;
+            pHeader->mpAllocator = mpAllocator;
+        }
+    }
+    if (mBuffer) {
+        mBufferBytes = bytes;
         mWidth = width;
         mHeight = height;
         mChannel = channel;
         mSize = width * height * channel;
+        mStride = stride;
+        mBorder = border;
+        mMarginLeft = mMarginTop = mMarginRight = mMarginBottom = 0;
+        mSharedView = 0;
+        mType = type;
+        mLayout = layout;
+        mPlaneStride = planeStride;
         mDebug = 0;
+        mData = static_cast<unsigned char*>(mBuffer) + BufferHeaderBytes +
+                ((size_t)border * stride + border * (planar ? 1 : channel)) * ElemSize(type);
     } else {
         status = CVError::MEMORY;
         SHOW_ERROR_AND_RETURN(status);
@@ -112,11 +395,275 @@ CVError Image::Allocate(int width, int height, int channel, int freeMemory)
 
 void Image::Release()
 {
-    if (mData) {
-        delete [] mData;
-        mData = nullptr;
+    // the last image sharing the buffer returns it
+    if (mBuffer) {
+        ImageBufferHeader *pHeader = static_cast<ImageBufferHeader*>(mBuffer);
+        if (pHeader->mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            pHeader->mpAllocator->Free(mBuffer, pHeader->mBytes);
+        mBuffer = nullptr;
+    }
+    mBufferBytes = 0;
+    mData = nullptr;
+    mWidth = mHeight = mChannel = mSize = mStride = mBorder = mDebug = 0;
+    mMarginLeft = mMarginTop = mMarginRight = mMarginBottom = 0;
+    mSharedView = 0;
+    mLayout = ImageLayout::INTERLEAVED;
+    mPlaneStride = 0;
+}
+
+// A view and a copy made at once on two threads see each other: the copy takes its reference
+// before it checks the pin, the view pins before it checks the count, both sequentially consistent.
+int Image::PinForView() const
+{
+    if (mBuffer == nullptr)
+        return mSharedView;
+
+    ImageBufferHeader *pHeader = static_cast<ImageBufferHeader*>(mBuffer);
+    pHeader->mPinned.store(1);
+    return (pHeader->mRefCount.load() > 1) ? 1 : 0;
+}
+
+CVError Image::GetView(Image &view, int x, int y, int width, int height)
+{
+    CVError status = Detach();
+    SHOW_ERROR_AND_RETURN(status);
+    return static_cast<const Image&>(*this).GetView(view, x, y, width, height);
+}
+
+CVError Image::GetView(Image &view, int x, int y, int width, int height) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (IsEmpty() || &view == this || width <= 0 || height <= 0 ||
+        x < -mMarginLeft || y < -mMarginTop || x + width > mWidth + mMarginRight || y + height > mHeight + mMarginBottom) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // the temporaries of the filters run on the view come from this image's allocator
+    view.Release();
+    view.mpAllocator = mpAllocator;
+    view.mWidth = width;
+    view.mHeight = height;
+    view.mChannel = mChannel;
+    view.mSize = width * height * mChannel;
+    view.mStride = mStride;
+    view.mType = mType;
+    view.mLayout = mLayout;
+    view.mPlaneStride = mPlaneStride;
+    view.mMarginLeft = x + mMarginLeft;  // the parent's own margins stay readable
+    view.mMarginTop = y + mMarginTop;
+    view.mMarginRight = mWidth + mMarginRight - (x + width);
+    view.mMarginBottom = mHeight + mMarginBottom - (y + height);
+    view.mSharedView = PinForView();
+    view.mData = const_cast<unsigned char*>(static_cast<const unsigned char*>(GetRowData(y))) +
+                 (ptrdiff_t)x * (IsPlanar() ? 1 : mChannel) * ElemSize(mType);
+
+    return status;
+}
+
+CVError Image::GetPlaneView(Image &view, int channel)
+{
+    CVError status = Detach();
+    SHOW_ERROR_AND_RETURN(status);
+    return static_cast<const Image&>(*this).GetPlaneView(view, channel);
+}
+
+CVError Image::GetPlaneView(Image &view, int channel) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (IsEmpty() || &view == this || channel < 0 || channel >= mChannel || (mChannel > 1 && !IsPlanar())) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    view.Release();
+    view.mpAllocator = mpAllocator;
+    view.mWidth = mWidth;
+    view.mHeight = mHeight;
+    view.mChannel = 1;
+    view.mSize = mWidth * mHeight;
+    view.mStride = mStride;
+    view.mType = mType;
+    view.mMarginLeft = mMarginLeft;
+    view.mMarginTop = mMarginTop;
+    view.mMarginRight = mMarginRight;
+    view.mMarginBottom = mMarginBottom;
+    view.mSharedView = PinForView();
+    view.mData = const_cast<unsigned char*>(static_cast<const unsigned char*>(mData)) + channel * mPlaneStride * ElemSize(mType);
+
+    return status;
+}
+
+// func(channel, srcPlane, dstPlane) on the views of every plane, dst is planar and as large as src
+template <typename F>
+static CVError ForEachPlane(const Image &src, Image &dst, F func)
+{
+    CVError status = CVError::NOERROR;
+    Image srcPlane, dstPlane;
+
+    for (int c = 0; c < src.GetChannel(); ++c) {
+        status = src.GetPlaneView(srcPlane, c);
+        SHOW_ERROR_AND_RETURN(status);
+        status = dst.GetPlaneView(dstPlane, c);
+        SHOW_ERROR_AND_RETURN(status);
+        status = func(c, srcPlane, dstPlane);
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    return status;
+}
+
+// one row of planes to interleaved pixels and back, 3 channels are unrolled
+template <typename T>
+static void InterleaveRow(const T * const *ppPlanes, T *pDst, int width, int channel)
+{
+    if (channel == 3) {
+        const T *p0 = ppPlanes[0], *p1 = ppPlanes[1], *p2 = ppPlanes[2];
+        for (int x = 0; x < width; ++x) {
+            pDst[3*x+0] = p0[x];
+            pDst[3*x+1] = p1[x];
+            pDst[3*x+2] = p2[x];
+        }
+    } else {
+        for (int c = 0; c < channel; ++c)
+            for (int x = 0; x < width; ++x)
+                pDst[x*channel+c] = ppPlanes[c][x];
+    }
+}
+
+template <typename T>
+static void DeinterleaveRow(const T *pSrc, T * const *ppPlanes, int width, int channel)
+{
+    if (channel == 3) {
+        T *p0 = ppPlanes[0], *p1 = ppPlanes[1], *p2 = ppPlanes[2];
+        for (int x = 0; x < width; ++x) {
+            p0[x] = pSrc[3*x+0];
+            p1[x] = pSrc[3*x+1];
+            p2[x] = pSrc[3*x+2];
+        }
+    } else {
+        for (int c = 0; c < channel; ++c)
+            for (int x = 0; x < width; ++x)
+                ppPlanes[c][x] = pSrc[x*channel+c];
+    }
+}
+
+// toPlanar: interleaved to planar, otherwise back
+template <typename T>
+static void ConvertLayout(const Image &src, Image &dst, bool toPlanar)
+{
+    const Image &planar = toPlanar ? dst : src;
+    int channel = src.GetChannel();
+    int width = src.GetWidth();
+    ThreadPool::Shared().ParallelFor(0, src.GetHeight(), rowGrain, [&](int begin, int end) {
+        vector<T*> ppPlanes(channel);
+        for (int y = begin; y < end; ++y) {
+            for (int c = 0; c < channel; ++c)
+                ppPlanes[c] = const_cast<T*>(planar.GetRow<T>(y)) + c * planar.GetPlaneStride();
+            if (toPlanar)
+                DeinterleaveRow(src.GetRow<T>(y), ppPlanes.data(), width, channel);
+            else
+                InterleaveRow(ppPlanes.data(), dst.GetRow<T>(y), width, channel);
+        }
+    });
+}
+
+static void ConvertLayout(const Image &src, Image &dst, bool toPlanar)
+{
+    switch (src.GetType())
+    {
+    case ImageType::UINT8:
+        ConvertLayout<unsigned char>(src, dst, toPlanar);
+        break;
+    case ImageType::UINT16:
+        ConvertLayout<unsigned short>(src, dst, toPlanar);
+        break;
+    case ImageType::FLOAT32:
+    default:
+        ConvertLayout<float>(src, dst, toPlanar);
+        break;
+    }
+}
+
+CVError Image::Interleave(Image &image) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (IsEmpty() || &image == this) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    status = image.Allocate(mWidth, mHeight, mChannel, mType);
+    SHOW_ERROR_AND_RETURN(status);
+    if (IsPlanar())
+        ConvertLayout(*this, image, false);
+    else
+        CopyRows(*this, image);
+
+    return status;
+}
+
+CVError Image::Deinterleave(Image &image) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (IsEmpty() || &image == this) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    status = image.AllocatePlanar(mWidth, mHeight, mChannel, mType);
+    SHOW_ERROR_AND_RETURN(status);
+    if (IsPlanar() || mChannel == 1)
+        CopyRows(*this, image);
+    else
+        ConvertLayout(*this, image, true);
+
+    return status;
+}
+
+size_t Image::GetBufferBytes() const
+{
+    return (size_t)mStride * (mHeight + 2*mBorder) * (mLayout == ImageLayout::PLANAR ? mChannel : 1) * ElemSize(mType);
+}
+
+template <typename T>
+static void ReplicateBorder(T *pData, int width, int height, int channel, int stride, int border)
+{
+    for (int y = 0; y < height; ++y)
+        ReplicateRowEdges(pData + (ptrdiff_t)y * stride, width, channel, border);
+
+    // whole padded rows above and below
+    size_t bytes = (size_t)stride * sizeof(T);
+    T *pFirst = pData - border*channel;
+    T *pLast = pFirst + (ptrdiff_t)(height-1) * stride;
+    for (int y = 1; y <= border; ++y) {
+        memcpy(pFirst - (ptrdiff_t)y * stride, pFirst, bytes);
+        memcpy(pLast + (ptrdiff_t)y * stride, pLast, bytes);
+    }
+}
+
+void Image::FillBorder()
+{
+    if (IsEmpty() || mBorder == 0 || Detach() != CVError::NOERROR)
+        return;
+
+    switch (mType)
+    {
+    case ImageType::UINT8:
+        ReplicateBorder(GetData<unsigned char>(), mWidth, mHeight, mChannel, mStride, mBorder);
+        break;
+    case ImageType::UINT16:
+        ReplicateBorder(GetData<unsigned short>(), mWidth, mHeight, mChannel, mStride, mBorder);
+        break;
+    case ImageType::FLOAT32:
+    default:
+        ReplicateBorder(GetData<float>(), mWidth, mHeight, mChannel, mStride, mBorder);
+        break;
     }
-    mWidth = mHeight = mChannel = mSize = mDebug = 0;
 }
 
 float Image::GetPixel(int x, int y, int channel) const
@@ -136,10 +683,28 @@ float Image::GetPixel(int x, int y, int channel) const
     else if (channel >= mChannel)
         channel = mChannel - 1;
 
-    return mData[y * mWidth * mChannel + x * mChannel + channel];
+    ptrdiff_t index = IsPlanar() ? channel * mPlaneStride + (ptrdiff_t)y * mStride + x : (ptrdiff_t)y * mStride + x * mChannel + channel;
+    switch (mType)
+    {
+    case ImageType::UINT8:
+        return static_cast<const unsigned char*>(mData)[index];
+    case ImageType::UINT16:
+        return static_cast<const unsigned short*>(mData)[index];
+    case ImageType::FLOAT32:
+    default:
+        return static_cast<const float*>(mData)[index];
+    }
 }
 
 void Image::SetPixel(int x, int y, int channel, float value)
+{
+    // a failed detach leaves the image empty
+    if (!IsEmpty() && Detach() == CVError::NOERROR)
+        WritePixel(x, y, channel, value);
+}
+
+// SetPixel() of an image that is not shared, Draw*() detach once for all their pixels
+void Image::WritePixel(int x, int y, int channel, float value)
 {
     if (x < 0)
         x = 0;
@@ -156,65 +721,392 @@ void Image::SetPixel(int x, int y, int channel, float value)
     else if (channel >= mChannel)
         channel = mChannel - 1;
 
-    mData[y * mWidth * mChannel + x * mChannel + channel] = value;
+    ptrdiff_t index = IsPlanar() ? channel * mPlaneStride + (ptrdiff_t)y * mStride + x : (ptrdiff_t)y * mStride + x * mChannel + channel;
+    switch (mType)
+    {
+    case ImageType::UINT8:
+        static_cast<unsigned char*>(mData)[index] = SaturateCast<unsigned char>(value);
+        break;
+    case ImageType::UINT16:
+        static_cast<unsigned short*>(mData)[index] = SaturateCast<unsigned short>(value);
+        break;
+    case ImageType::FLOAT32:
+    default:
+        static_cast<float*>(mData)[index] = value;
+        break;
+    }
+}
+
+// libjpeg exits the process on a fatal error by default, this one jumps back to the
+// DecodeJpeg() or EncodeJpeg() call, which returns FILEACCESS. Only libjpeg's own
+// frames are skipped by the jump. The locals of a setjmp frame that live across the
+// jump are volatile, a register copy of them is not restored.
+struct JpegErrorManager {
+    struct jpeg_error_mgr mPublic;
+    jmp_buf mJump;
+};
+
+static void JpegErrorExit(j_common_ptr cinfo)
+{
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(reinterpret_cast<JpegErrorManager*>(cinfo->err)->mJump, 1);
+}
+
+static struct jpeg_error_mgr* JpegErrors(JpegErrorManager &jerr)
+{
+    jpeg_std_error(&jerr.mPublic);
+    jerr.mPublic.error_exit = JpegErrorExit;
+    return &jerr.mPublic;
+}
+
+// let libjpeg drop the chroma and shrink in the DCT domain instead of doing it afterwards
+static void SetDecodeParam(struct jpeg_decompress_struct &cinfo, const JpegReadParam &param)
+{
+    if (param.gray)
+        cinfo.out_color_space = JCS_GRAYSCALE;
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = (param.scaleDenom > 0) ? param.scaleDenom : 1;
+    cinfo.dct_method = param.fastIdct ? JDCT_IFAST : JDCT_ISLOW;
+    cinfo.do_fancy_upsampling = param.fancyUpsampling ? TRUE : FALSE;
+}
+
+// decodes from pFile, or from pData when pFile is null. The jump is armed before cinfo is
+// created, so a failure anywhere in libjpeg, its setup included, comes back here
+static CVError DecodeJpeg(FILE *pFile, const unsigned char *pData, size_t size, const JpegReadParam &param, Image &img)
+{
+    volatile CVError status = CVError::NOERROR;
+    struct jpeg_decompress_struct cinfo;
+    JpegErrorManager jerr;
+    unsigned char *pTmp;
+
+    // a zeroed cinfo has no memory manager yet, so destroying it is safe whenever the jump comes
+    memset(&cinfo, 0, sizeof(cinfo));
+    cinfo.err = JpegErrors(jerr);
+    if (setjmp(jerr.mJump)) {
+        jpeg_destroy_decompress(&cinfo);
+        img.Release();
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    jpeg_create_decompress(&cinfo);
+    if (pFile != nullptr)
+        jpeg_stdio_src(&cinfo, pFile);
+    else
+        // older libjpeg declares the source buffer non-const, it is only read
+        jpeg_mem_src(&cinfo, const_cast<unsigned char*>(pData), (unsigned long)size);
+
+    jpeg_read_header(&cinfo, TRUE);
+    SetDecodeParam(cinfo, param);
+    jpeg_start_decompress(&cinfo);    
+
+    // 8-bit samples are decoded straight into the image, no conversion
+    status = img.Allocate(cinfo.output_width, cinfo.output_height, cinfo.output_components, ImageType::UINT8);
+    if (CVError::NOERROR != status) {
+        jpeg_destroy_decompress(&cinfo);
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    while (cinfo.output_scanline < cinfo.output_height) {
+        pTmp = img.GetRow<unsigned char>(cinfo.output_scanline);
+        jpeg_read_scanlines(&cinfo, &pTmp, 1);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return status;
+}
+
+// a libjpeg destination appending to a std::vector, so a caller's buffer keeps its capacity between frames
+struct VectorDestination {
+    struct jpeg_destination_mgr mPublic;
+    vector<unsigned char> *mpBuffer;
+    size_t mUsed;
+};
+
+static void InitVectorDestination(j_compress_ptr cinfo)
+{
+    VectorDestination *pDest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+    pDest->mUsed = 0;
+    if (pDest->mpBuffer->size() < 4096)
+        pDest->mpBuffer->resize(4096);
+    pDest->mPublic.next_output_byte = pDest->mpBuffer->data();
+    pDest->mPublic.free_in_buffer = pDest->mpBuffer->size();
+}
+
+static boolean EmptyVectorDestination(j_compress_ptr cinfo)
+{
+    // called when the whole buffer is full, double it
+    VectorDestination *pDest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+    pDest->mUsed = pDest->mpBuffer->size();
+    pDest->mpBuffer->resize(2 * pDest->mUsed);
+    pDest->mPublic.next_output_byte = pDest->mpBuffer->data() + pDest->mUsed;
+    pDest->mPublic.free_in_buffer = pDest->mpBuffer->size() - pDest->mUsed;
+    return TRUE;
+}
+
+static void TermVectorDestination(j_compress_ptr cinfo)
+{
+    VectorDestination *pDest = reinterpret_cast<VectorDestination*>(cinfo->dest);
+    pDest->mpBuffer->resize(pDest->mpBuffer->size() - pDest->mPublic.free_in_buffer);
+}
+
+// encodes into pFile, or into pBuffer when pFile is null. The jump is armed before cinfo is created
+static CVError EncodeJpeg(FILE *pFile, vector<unsigned char> *pBuffer, const JpegWriteParam &param, const Image &img)
+{
+    volatile CVError status = CVError::NOERROR;
+    struct jpeg_compress_struct cinfo;
+    JpegErrorManager jerr;
+    VectorDestination dest;
+    unsigned char *pTmp;
+
+    // libjpeg takes interleaved scanlines
+    if (img.IsPlanar()) {
+        Image interleaved;
+        status = img.Interleave(interleaved);
+        SHOW_ERROR_AND_RETURN(status);
+        return EncodeJpeg(pFile, pBuffer, param, interleaved);
+    }
+
+    // 8-bit images are handed to libjpeg as they are, others are saturated row by row
+    unsigned char * volatile pRow = nullptr;
+    if (img.GetType() != ImageType::UINT8) {
+        pRow = new unsigned char [img.GetWidth() * img.GetChannel()];
+        if (pRow == nullptr) {
+            status = CVError::MEMORY;
+            SHOW_ERROR_AND_RETURN(status);
+        }
+    }
+
+    memset(&cinfo, 0, sizeof(cinfo));
+    cinfo.err = JpegErrors(jerr);
+    if (setjmp(jerr.mJump)) {
+        jpeg_destroy_compress(&cinfo);
+        delete [] pRow;
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    jpeg_create_compress(&cinfo);
+    if (pFile != nullptr) {
+        jpeg_stdio_dest(&cinfo, pFile);
+    } else {
+        dest.mPublic.init_destination = InitVectorDestination;
+        dest.mPublic.empty_output_buffer = EmptyVectorDestination;
+        dest.mPublic.term_destination = TermVectorDestination;
+        dest.mpBuffer = pBuffer;
+        dest.mUsed = 0;
+        cinfo.dest = &dest.mPublic;
+    }
+
+    cinfo.image_width = img.GetWidth();
+    cinfo.image_height = img.GetHeight();
+    cinfo.input_components = img.GetChannel();
+    cinfo.in_color_space = (img.GetChannel() == 1) ? JCS_GRAYSCALE : JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, param.quality, TRUE);
+    cinfo.dct_method = param.fastDct ? JDCT_IFAST : JDCT_ISLOW;
+    cinfo.optimize_coding = param.optimizeCoding ? TRUE : FALSE;
+#if JPEG_LIB_VERSION >= 70
+    cinfo.do_fancy_downsampling = param.fancyDownsampling ? TRUE : FALSE;
+#endif
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while ((int)cinfo.next_scanline < img.GetHeight()) {
+        const unsigned char *pSrc = static_cast<const unsigned char*>(img.GetRowData(cinfo.next_scanline));
+        if (pRow) {
+            ConvertElements(pSrc, img.GetType(), pRow, ImageType::UINT8, cinfo.image_width*cinfo.input_components, 1.0f, 0.0f);
+            pTmp = pRow;
+        } else {
+            pTmp = const_cast<unsigned char*>(pSrc);
+        }
+        jpeg_write_scanlines(&cinfo, &pTmp, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    delete [] pRow;
+
+    return status;
+}
+
+CVError Image::ReadJpegImage(const char *pName)
+{
+    return ReadJpegImage(pName, JpegReadParam());
+}
+
+CVError Image::ReadJpegImage(const char *pName, const JpegReadParam &param)
+{
+    CVError status = CVError::NOERROR;
+    ProfileScope scope("ReadJpegImage");
+
+    FILE *pFile;
+    
+    pFile = fopen(pName, "rb");
+    if (pFile == nullptr) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }    
+
+    status = DecodeJpeg(pFile, nullptr, 0, param, *this);
+    fclose(pFile);
+
+    return status;
+}
+
+CVError Image::ReadJpegImage(const unsigned char *pData, size_t size, const JpegReadParam &param)
+{
+    CVError status = CVError::NOERROR;
+    ProfileScope scope("ReadJpegImage(memory)");
+
+    if (pData == nullptr || size == 0) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    status = DecodeJpeg(nullptr, pData, size, param, *this);
+
+    return status;
+}
+
+CVError Image::ReadJpegImageMapped(const char *pName, const JpegReadParam &param)
+{
+    CVError status = CVError::NOERROR;
+    ProfileScope scope("ReadJpegImageMapped");
+
+    int fd = open(pName, O_RDONLY);
+    if (fd < 0) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // the page cache is decoded in place, the mapping outlives the descriptor
+    size_t size = (size_t)info.st_size;
+    void *pMap = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (pMap == MAP_FAILED) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+    madvise(pMap, size, MADV_SEQUENTIAL);
+
+    status = ReadJpegImage(static_cast<const unsigned char*>(pMap), size, param);
+    munmap(pMap, size);
+
+    return status;
 }
 
-CVError Image::ReadJpegImage(const char *pName)
+struct JpegScanlineSource {
+    struct jpeg_decompress_struct mInfo;
+    JpegErrorManager mErrors;
+    FILE *mpFile;
+};
+
+CVError JpegScanlineReader::Open(const char *pName, const JpegReadParam &param)
 {
-    CVError status = CVError::NOERROR;
+    volatile CVError status = CVError::NOERROR;
 
-    FILE *pFile;
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    unsigned char *pTmp;
-    
-    pFile = fopen(pName, "rb");
+    Close();
+
+    FILE *pFile = fopen(pName, "rb");
     if (pFile == nullptr) {
         status = CVError::FILEACCESS;
         SHOW_ERROR_AND_RETURN(status);
-    }    
+    }
+
+    mpSource = new (nothrow) JpegScanlineSource;
+    if (mpSource == nullptr) {
+        fclose(pFile);
+        status = CVError::MEMORY;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+    mpSource->mpFile = pFile;
+
+    // as in DecodeJpeg, the jump is armed before cinfo is created, Close() destroys a zeroed cinfo safely
+    struct jpeg_decompress_struct &cinfo = mpSource->mInfo;
+    memset(&cinfo, 0, sizeof(cinfo));
+    cinfo.err = JpegErrors(mpSource->mErrors);
+    if (setjmp(mpSource->mErrors.mJump)) {
+        Close();
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
 
-    cinfo.err = jpeg_std_error(&jerr);
     jpeg_create_decompress(&cinfo);
     jpeg_stdio_src(&cinfo, pFile);
     jpeg_read_header(&cinfo, TRUE);
-    jpeg_start_decompress(&cinfo);    
+    SetDecodeParam(cinfo, param);
+    jpeg_start_decompress(&cinfo);
 
-    status = Allocate(cinfo.output_width, cinfo.output_height, cinfo.output_components);
-    if (CVError::NOERROR != status) {
-        jpeg_finish_decompress(&cinfo);
-        jpeg_destroy_decompress(&cinfo);
-        fclose(pFile);
+    mWidth = cinfo.output_width;
+    mHeight = cinfo.output_height;
+    mChannel = cinfo.output_components;
+    mNextRow = 0;
+
+    return status;
+}
+
+CVError JpegScanlineReader::ReadRows(unsigned char **ppRows, int count, int &rows)
+{
+    volatile CVError status = CVError::NOERROR;
+
+    rows = 0;
+    if (mpSource == nullptr || ppRows == nullptr || count < 0) {
+        status = CVError::INPUT;
         SHOW_ERROR_AND_RETURN(status);
     }
 
-    pTmp = new unsigned char [cinfo.output_width * cinfo.output_components];
-    if (pTmp == nullptr) {
-        status = CVError::MEMORY;
-        jpeg_finish_decompress(&cinfo);
-        jpeg_destroy_decompress(&cinfo);
-        fclose(pFile);
+    struct jpeg_decompress_struct &cinfo = mpSource->mInfo;
+    if (setjmp(mpSource->mErrors.mJump)) {
+        Close();
+        status = CVError::FILEACCESS;
         SHOW_ERROR_AND_RETURN(status);
     }
 
-    while (cinfo.output_scanline < cinfo.output_height) {
-        unsigned int i = 0;
-        jpeg_read_scanlines(&cinfo, &pTmp, 1);
-        for (; i < cinfo.output_width*cinfo.output_components; ++i)
-            mData[(cinfo.output_scanline-1)*cinfo.output_width*cinfo.output_components+i] = (float)pTmp[i];
-    }
+    while (rows < count && cinfo.output_scanline < cinfo.output_height)
+        rows += jpeg_read_scanlines(&cinfo, ppRows + rows, count - rows);
+    mNextRow = cinfo.output_scanline;
 
-    jpeg_finish_decompress(&cinfo);
-    jpeg_destroy_decompress(&cinfo);
-    delete [] pTmp;
-    fclose(pFile);
+    // the trailing markers are read once, after the last row
+    if (rows > 0 && cinfo.output_scanline == cinfo.output_height)
+        jpeg_finish_decompress(&cinfo);
 
     return status;
 }
 
+void JpegScanlineReader::Close()
+{
+    if (mpSource != nullptr) {
+        jpeg_destroy_decompress(&mpSource->mInfo);
+        fclose(mpSource->mpFile);
+        delete mpSource;
+    }
+    mpSource = nullptr;
+    mWidth = 0;
+    mHeight = 0;
+    mChannel = 0;
+    mNextRow = 0;
+}
+
 CVError Image::WriteJpegImage(const char *pName, int quality) const
+{
+    JpegWriteParam param;
+    param.quality = quality;
+    return WriteJpegImage(pName, param);
+}
+
+CVError Image::WriteJpegImage(const char *pName, const JpegWriteParam &param) const
 {
     CVError status = CVError::NOERROR;
+    ProfileScope scope("WriteJpegImage");
 
     if (IsEmpty()) {
         status = CVError::INPUT;
@@ -222,9 +1114,6 @@ CVError Image::WriteJpegImage(const char *pName, int quality) const
     }
 
     FILE *pFile;
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    unsigned char *pTmp;
 
     pFile = fopen(pName, "wb");
     if (pFile == nullptr) {
@@ -232,58 +1121,92 @@ CVError Image::WriteJpegImage(const char *pName, int quality) const
         SHOW_ERROR_AND_RETURN(status);
     }
 
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    jpeg_stdio_dest(&cinfo, pFile);
-    cinfo.image_width = mWidth;
-    cinfo.image_height = mHeight;
-    cinfo.input_components = mChannel;
-    cinfo.in_color_space = (mChannel == 1) ? JCS_GRAYSCALE : JCS_RGB;
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, quality, TRUE);
-    jpeg_start_compress(&cinfo, TRUE);
-    pTmp = new unsigned char [cinfo.image_width * cinfo.input_components];
+    status = EncodeJpeg(pFile, nullptr, param, *this);
+    fclose(pFile);
 
-    if (pTmp == nullptr) {
-        status = CVError::MEMORY;
-        jpeg_finish_compress(&cinfo);
-        jpeg_destroy_compress(&cinfo);
-        fclose(pFile);
+    return status;
+}
+
+CVError Image::WriteJpegImage(vector<unsigned char> &buffer, const JpegWriteParam &param) const
+{
+    CVError status = CVError::NOERROR;
+    ProfileScope scope("WriteJpegImage(memory)");
+
+    if (IsEmpty()) {
+        status = CVError::INPUT;
         SHOW_ERROR_AND_RETURN(status);
     }
 
-    while ((int)cinfo.next_scanline < mHeight) {
-        unsigned int i = 0;
-        for (; i < cinfo.image_width*cinfo.input_components; ++i)
-            pTmp[i] = (unsigned char)(mData[cinfo.next_scanline*cinfo.image_width*cinfo.input_components + i] + 0.5f);
-        jpeg_write_scanlines(&cinfo, &pTmp, 1);
+    status = EncodeJpeg(nullptr, &buffer, param, *this);
+
+    return status;
+}
+
+CVError Image::ConvertTo(Image &image, ImageType type, float alpha, float beta) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (IsEmpty() || &image == this) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
     }
 
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-    delete [] pTmp;
-    fclose(pFile);
+    if (IsPlanar()) {
+        status = image.AllocatePlanar(mWidth, mHeight, mChannel, type);
+        SHOW_ERROR_AND_RETURN(status);
+        return ForEachPlane(*this, image, [&](int, const Image &src, Image &dst) { return src.ConvertTo(dst, type, alpha, beta); });
+    }
+
+    status = image.Allocate(mWidth, mHeight, mChannel, type);
+    SHOW_ERROR_AND_RETURN(status);
+
+    ThreadPool::Shared().ParallelFor(0, mHeight, rowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y)
+            ConvertElements(GetRowData(y), mType, image.GetRowData(y), type, mWidth*mChannel, alpha, beta);
+    });
 
     return status;
 }
 
+template <typename T>
+static void RGB2GrayPixels(const Image &src, Image &dst)
+{
+    size_t plane = src.GetPlaneStride();
+    ThreadPool::Shared().ParallelFor(0, src.GetHeight(), rowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            const T *pSrc = src.GetRow<T>(y);
+            if (src.IsPlanar())
+                RGB2GrayRow(pSrc, pSrc + plane, pSrc + 2*plane, dst.GetRow<T>(y), src.GetWidth());
+            else
+                RGB2GrayRow(pSrc, dst.GetRow<T>(y), src.GetWidth());
+        }
+    });
+}
+
 CVError Image::RGB2Gray(Image &image) const
 {
     CVError status = CVError::NOERROR;
 
     if (mChannel == 3) {
-        status = image.Allocate(mWidth, mHeight, 1);
+        // the gray image keeps the element type of the source
+        status = image.Allocate(mWidth, mHeight, 1, mType);
         SHOW_ERROR_AND_RETURN(status);
 
-        for (int i = 0; i < mHeight; ++i) {
-            for (int j = 0; j < mWidth; ++j) {
-                image.mData[i*mWidth+j] = 
-                    0.144f * mData[i*mWidth*mChannel+mChannel*j+0] +
-                    0.587f * mData[i*mWidth*mChannel+mChannel*j+1] +
-                    0.299f * mData[i*mWidth*mChannel+mChannel*j+2];
-            }
+        switch (mType)
+        {
+        case ImageType::UINT8:
+            RGB2GrayPixels<unsigned char>(*this, image);
+            break;
+        case ImageType::UINT16:
+            RGB2GrayPixels<unsigned short>(*this, image);
+            break;
+        case ImageType::FLOAT32:
+        default:
+            RGB2GrayPixels<float>(*this, image);
+            break;
         }
     } else if (mChannel == 1) {
+        // the gray image shares the pixels, a caller writing into it from parallel bands detaches it first
         image = *this;
         if (image.IsEmpty()) {
             status = CVError::MEMORY;
@@ -298,104 +1221,260 @@ CVError Image::RGB2Gray(Image &image) const
     return status;
 }
 
-CVError Image::Normalize(Image &image, float lowerBoundary, float upperBoundary) const
+template <typename T>
+static void MinMaxRow(const T *pSrc, int width, int channel, float *pMin, float *pMax)
 {
-    CVError status = CVError::NOERROR;
-    float max[mChannel];
-    float min[mChannel];
     float value;
-    
-    status = image.Allocate(mWidth, mHeight, mChannel);
-    SHOW_ERROR_AND_RETURN(status);
+    for (int x = 0; x < width; ++x) {
+        for (int c = 0; c < channel; ++c) {
+            value = (float)pSrc[x*channel+c];
+            if (pMax[c] < value)
+                pMax[c] = value;
+            if (pMin[c] > value)
+                pMin[c] = value;
+        }
+    }
+}
 
-    for (int c = 0; c < mChannel; ++c) {
-        max[c] = numeric_limits<float>::lowest();
-        min[c] = numeric_limits<float>::max();
-        for (int y = 0; y < mHeight; ++y) {
-            for (int x = 0; x < mWidth; ++x) {
-                value = GetPixel(x, y, c);
-                if (max[c] < value)
-                    max[c] = value;
-                if (min[c] > value)
-                    min[c] = value;
+// a float channel that is alone in its row takes the vector kernels
+static void MinMaxRow(const float *pSrc, int width, int channel, float *pMin, float *pMax)
+{
+    if (channel == 1)
+        MinMaxElements(pSrc, width, pMin[0], pMax[0]);
+    else
+        MinMaxRow<float>(pSrc, width, channel, pMin, pMax);
+}
+
+template <typename T>
+static void MinMaxPixels(const Image &src, vector<float> &min, vector<float> &max)
+{
+    ThreadPool &pool = ThreadPool::Shared();
+    int channel = src.GetChannel();
+    int height = src.GetHeight();
+    int bands = pool.GetBandCount(height, rowGrain);
+
+    // min and max per band, merged afterwards, which is exact in any order
+    vector<float> bandMax(bands * channel, numeric_limits<float>::lowest());
+    vector<float> bandMin(bands * channel, numeric_limits<float>::max());
+    pool.ParallelBands(bands, [&](int band) {
+        float *pMax = bandMax.data() + band * channel;
+        float *pMin = bandMin.data() + band * channel;
+        for (int y = height * band / bands; y < height * (band + 1) / bands; ++y) {
+            const T *pSrc = src.GetRow<T>(y);
+            if (src.IsPlanar()) {
+                for (int c = 0; c < channel; ++c)
+                    MinMaxRow(pSrc + c * src.GetPlaneStride(), src.GetWidth(), 1, pMin + c, pMax + c);
+            } else {
+                MinMaxRow(pSrc, src.GetWidth(), channel, pMin, pMax);
             }
         }
+    });
+
+    max.assign(bandMax.begin(), bandMax.begin() + channel);
+    min.assign(bandMin.begin(), bandMin.begin() + channel);
+    for (int band = 1; band < bands; ++band) {
+        for (int c = 0; c < channel; ++c) {
+            max[c] = std::max(max[c], bandMax[band * channel + c]);
+            min[c] = std::min(min[c], bandMin[band * channel + c]);
+        }
+    }
+}
+
+CVError Image::MinMax(vector<float> &min, vector<float> &max) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (IsEmpty()) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    switch (mType)
+    {
+    case ImageType::UINT8:
+        MinMaxPixels<unsigned char>(*this, min, max);
+        break;
+    case ImageType::UINT16:
+        MinMaxPixels<unsigned short>(*this, min, max);
+        break;
+    case ImageType::FLOAT32:
+    default:
+        MinMaxPixels<float>(*this, min, max);
+        break;
     }
 
-    for (int c = 0; c < mChannel; ++c) {
-        for (int y = 0; y < mHeight; ++y) {
-            for (int x = 0; x < mWidth; ++x) {
-                value = GetPixel(x, y, c);
-                value = (value - min[c]) / (max[c] - min[c]) * (upperBoundary - lowerBoundary) + lowerBoundary;
-                image.SetPixel(x, y, c, value);
+    return status;
+}
+
+template <typename T>
+static void NormalizePixels(const Image &src, Image &dst, const vector<float> &min, const vector<float> &max,
+                            float lowerBoundary, float upperBoundary)
+{
+    int channel = src.GetChannel();
+    ThreadPool::Shared().ParallelFor(0, src.GetHeight(), rowGrain, [&](int begin, int end) {
+        float value;
+        for (int y = begin; y < end; ++y) {
+            const T *pSrc = src.GetRow<T>(y);
+            float *pDst = dst.GetRow<float>(y);
+            for (int x = 0; x < src.GetWidth(); ++x) {
+                for (int c = 0; c < channel; ++c) {
+                    value = (float)pSrc[x*channel+c];
+                    pDst[x*channel+c] = (value - min[c]) / (max[c] - min[c]) * (upperBoundary - lowerBoundary) + lowerBoundary;
+                }
             }
         }
+    });
+}
+
+CVError Image::Normalize(Image &image, float lowerBoundary, float upperBoundary) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (IsEmpty() || &image == this) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // every plane has its own range, as every channel has
+    if (IsPlanar()) {
+        status = image.AllocatePlanar(mWidth, mHeight, mChannel);
+        SHOW_ERROR_AND_RETURN(status);
+        return ForEachPlane(*this, image, [&](int, const Image &src, Image &dst) {
+            return src.Normalize(dst, lowerBoundary, upperBoundary);
+        });
+    }
+
+    vector<float> min, max;
+    status = MinMax(min, max);
+    SHOW_ERROR_AND_RETURN(status);
+    status = image.Allocate(mWidth, mHeight, mChannel, ImageType::FLOAT32);
+    SHOW_ERROR_AND_RETURN(status);
+
+    switch (mType)
+    {
+    case ImageType::UINT8:
+        NormalizePixels<unsigned char>(*this, image, min, max, lowerBoundary, upperBoundary);
+        break;
+    case ImageType::UINT16:
+        NormalizePixels<unsigned short>(*this, image, min, max, lowerBoundary, upperBoundary);
+        break;
+    case ImageType::FLOAT32:
+    default:
+        NormalizePixels<float>(*this, image, min, max, lowerBoundary, upperBoundary);
+        break;
     }
 
     return status;
 }
 
-CVError Image::Sobel(Image &dX, Image &dY) const
+// the vertical pass, also over the real pixels of a view's margins, which are replicated where there are none
+template <typename Smooth, typename T>
+static void DerivativeColumns(const Image &src, Image &filterX, Image &filterY)
+{
+    int width = src.GetWidth();
+    int height = src.GetHeight();
+    int channel = src.GetChannel();
+    int left = std::min(src.GetMarginLeft(), 1);
+    int right = std::min(src.GetMarginRight(), 1);
+    int top = -std::min(src.GetMarginTop(), 1);
+    int bottom = height - 1 + std::min(src.GetMarginBottom(), 1);
+    int count = (width + left + right) * channel;
+
+    ThreadPool::Shared().ParallelFor(0, height, rowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            const T *ppRows[3] = {
+                src.GetRow<T>(y > top ? y-1 : top) - left*channel,
+                src.GetRow<T>(y) - left*channel,
+                src.GetRow<T>(y < bottom ? y+1 : bottom) - left*channel,
+            };
+            float *pX = filterX.GetRow<float>(y);
+            float *pY = filterY.GetRow<float>(y);
+            ConvolveColumns<Smooth>(ppRows, pX - left*channel, count);
+            ConvolveColumns<CentralDifference>(ppRows, pY - left*channel, count);
+            ReplicateRowEdges(pX, width, channel, 1, left, right);
+            ReplicateRowEdges(pY, width, channel, 1, left, right);
+        }
+    });
+}
+
+// Sobel and Scharr: the central difference along one axis, smoothed with a 3-tap Smooth across it
+template <typename Smooth>
+static CVError Derivative(const Image &src, Image &dX, Image &dY)
 {
     CVError status = CVError::NOERROR;
 
-    if (IsEmpty()) {
+    if (src.IsEmpty()) {
         status = CVError::INPUT;
         SHOW_ERROR_AND_RETURN(status);
     }
 
+    int width = src.GetWidth();
+    int height = src.GetHeight();
+    int channel = src.GetChannel();
+    if (src.IsPlanar()) {
+        status = dX.AllocatePlanar(width, height, channel);
+        SHOW_ERROR_AND_RETURN(status);
+        status = dY.AllocatePlanar(width, height, channel);
+        SHOW_ERROR_AND_RETURN(status);
+        Image dYPlane;
+        return ForEachPlane(src, dX, [&](int c, const Image &srcPlane, Image &dXPlane) {
+            CVError planeStatus = dY.GetPlaneView(dYPlane, c);
+            SHOW_ERROR_AND_RETURN(planeStatus);
+            return Derivative<Smooth>(srcPlane, dXPlane, dYPlane);
+        });
+    }
+
     Image filterX; // horizontal
     Image filterY; // vertical
-    static float kernel1[3] = {1.0f, 2.0f, 1.0f};
-    static float kernel2[3] = {-1.0f, 0.0f, 1.0f};
-    float sum1;
-    float sum2;
-    float value;
+    // the temporaries come from where the results come from, e.g. a caller's BufferPool
+    filterX.SetAllocator(dX.GetAllocator());
+    filterY.SetAllocator(dX.GetAllocator());
 
-    status = filterX.Allocate(mWidth, mHeight, mChannel);
+    // the intermediates are padded so the horizontal pass needs no clamping
+    status = filterX.AllocatePadded(width, height, channel, 1);
     SHOW_ERROR_AND_RETURN(status);
-    status = filterY.Allocate(mWidth, mHeight, mChannel);
+    status = filterY.AllocatePadded(width, height, channel, 1);
     SHOW_ERROR_AND_RETURN(status);
-    status = dX.Allocate(mWidth, mHeight, mChannel);
+    status = dX.Allocate(width, height, channel, ImageType::FLOAT32);
     SHOW_ERROR_AND_RETURN(status);
-    status = dY.Allocate(mWidth, mHeight, mChannel);
+    status = dY.Allocate(width, height, channel, ImageType::FLOAT32);
     SHOW_ERROR_AND_RETURN(status);
 
-    for (int c = 0; c < mChannel; ++c) {
-        for (int y = 0; y < mHeight; ++y) {
-            for (int x = 0; x < mWidth; ++x) {
-                sum1 = 0.0f;
-                sum2 = 0.0f;
-                for (int k = -1; k < 2; ++k) {
-                    value = GetPixel(x, y+k, c);
-                    sum1 += value * kernel1[1+k];
-                    sum2 += value * kernel2[1+k];
-                }
-                filterX.SetPixel(x, y, c, sum1);
-                filterY.SetPixel(x, y, c, sum2);
-            }
-        }
+    switch (src.GetType())
+    {
+    case ImageType::UINT8:
+        DerivativeColumns<Smooth, unsigned char>(src, filterX, filterY);
+        break;
+    case ImageType::UINT16:
+        DerivativeColumns<Smooth, unsigned short>(src, filterX, filterY);
+        break;
+    case ImageType::FLOAT32:
+    default:
+        DerivativeColumns<Smooth, float>(src, filterX, filterY);
+        break;
     }
 
-    for (int c = 0; c < mChannel; ++c) {
-        for (int y = 0; y < mHeight; ++y) {
-            for (int x = 0; x < mWidth; ++x) {
-                sum1 = 0.0f;
-                sum2 = 0.0f;
-                for (int k = -1; k < 2; ++k) {
-                    sum1 += filterX.GetPixel(x+k, y, c) * kernel2[1+k];
-                    sum2 += filterY.GetPixel(x+k, y, c) * kernel1[1+k];
-                }
-                dX.SetPixel(x, y, c, sum1);
-                dY.SetPixel(x, y, c, sum2);
-            }
+    ThreadPool::Shared().ParallelFor(0, height, rowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            ConvolveRow<CentralDifference>(filterX.GetRow<float>(y), channel, dX.GetRow<float>(y), width*channel);
+            ConvolveRow<Smooth>(filterY.GetRow<float>(y), channel, dY.GetRow<float>(y), width*channel);
         }
-    }
+    });
 
     return status;
 }
 
-static CVError GaussianKernel(Image &kernel, int &size, int &center, float sigma)
+CVError Image::Sobel(Image &dX, Image &dY) const
+{
+    return Derivative<SobelSmooth>(*this, dX, dY);
+}
+
+CVError Image::Scharr(Image &dX, Image &dY) const
+{
+    return Derivative<ScharrSmooth>(*this, dX, dY);
+}
+
+CVError GaussianKernel(Image &kernel, int &size, int &center, float sigma)
 {
     CVError status = CVError::NOERROR;
 
@@ -438,14 +1517,20 @@ CVError Image::GaussianBlur(Image &g, float sigma) const
         SHOW_ERROR_AND_RETURN(status);
     }
 
-    status = g.Allocate(mWidth, mHeight, mChannel);
+    if (IsPlanar()) {
+        status = g.AllocatePlanar(mWidth, mHeight, mChannel);
+        SHOW_ERROR_AND_RETURN(status);
+        return ForEachPlane(*this, g, [&](int, const Image &src, Image &dst) { return src.GaussianBlur(dst, sigma); });
+    }
+
+    status = g.Allocate(mWidth, mHeight, mChannel, ImageType::FLOAT32);
     SHOW_ERROR_AND_RETURN(status);
 
     Image filter1D;
-    status = filter1D.Allocate(mWidth, mHeight, mChannel);
-    SHOW_ERROR_AND_RETURN(status);
+    filter1D.SetAllocator(g.GetAllocator());
 
     Image kernel;    
+    kernel.SetAllocator(g.GetAllocator());
     int size, center;
     status = GaussianKernel(kernel, size, center, sigma);
     SHOW_ERROR_AND_RETURN(status);
@@ -457,50 +1542,321 @@ CVError Image::GaussianBlur(Image &g, float sigma) const
         cout << endl;
     }
 
-    float sum;
+    const float *pKernel = kernel.GetData<float>();
+    int count = mWidth * mChannel;
 
-    // convolve horizontal       
-    for (int c = 0; c < mChannel; ++c) {
-        for (int i = 0; i < mHeight; ++i) {
-            for (int j = 0; j < mWidth; ++j) {
-                sum = 0.0f;
-                for (int k = 0; k < size; ++k) {
-                    sum += GetPixel(j+k-center, i, c) * kernel.GetPixel(k, 0, 0);
-                }
-                filter1D.SetPixel(j, i, c, sum);
-            }
+    // a view's margins within the kernel radius are filtered too, filter1D row 0 is source row -top
+    int left = std::min(mMarginLeft, center);
+    int right = std::min(mMarginRight, center);
+    int top = std::min(mMarginTop, center);
+    int bottom = std::min(mMarginBottom, center);
+    status = filter1D.Allocate(mWidth, mHeight + top + bottom, mChannel);
+    SHOW_ERROR_AND_RETURN(status);
+
+    ThreadPool &pool = ThreadPool::Shared();
+
+    // convolve horizontal, every source row is copied into a line padded by the kernel radius
+    pool.ParallelFor(0, mHeight + top + bottom, rowGrain, [&](int begin, int end) {
+        vector<float> line((mWidth + 2*center) * mChannel);
+        float *pLine = line.data() + center*mChannel;
+        size_t leftBytes = (size_t)left * mChannel * ElemSize(mType);
+        for (int i = begin; i < end; ++i) {
+            const unsigned char *pSrc = static_cast<const unsigned char*>(GetRowData(i - top)) - leftBytes;
+            ConvertElements(pSrc, mType, pLine - left*mChannel, ImageType::FLOAT32, (mWidth + left + right) * mChannel, 1.0f, 0.0f);
+            ReplicateRowEdges(pLine, mWidth, mChannel, center, left, right);
+            ConvolveRow(pLine, mChannel, pKernel, size, center, filter1D.GetRow<float>(i), count);
         }
-    }           
-
-    // convolve vertical
-    for (int c = 0; c < mChannel; ++c) {
-        for (int i = 0; i < mHeight; ++i) {
-            for (int j = 0; j < mWidth; ++j) {
-                sum = 0.0f;
-                for (int k = 0; k < size; ++k) {
-                    sum += filter1D.GetPixel(j, i+k-center, c) * kernel.GetPixel(k, 0, 0);
-                }
-                g.SetPixel(j, i, c, sum);
+    });
+
+    // convolve vertical, only the row pointers are clamped
+    pool.ParallelFor(0, mHeight, rowGrain, [&](int begin, int end) {
+        vector<const float*> rows(size);
+        for (int i = begin; i < end; ++i) {
+            for (int k = 0; k < size; ++k)
+                rows[k] = filter1D.GetRow<float>(std::min(std::max(i+k-center, -top), mHeight-1+bottom) + top);
+            ConvolveColumns(rows.data(), pKernel, size, g.GetRow<float>(i), count);
+        }
+    });
+
+    return status;
+}
+
+// y[n] = b*x[n] + a1*y[n-1] + a2*y[n-2] + a3*y[n-3], run forward and then backward
+struct RecursiveCoeffs {
+    float b;
+    float a1;
+    float a2;
+    float a3;
+};
+
+// Young and van Vliet, "Recursive implementation of the Gaussian filter", 1995
+static RecursiveCoeffs YoungVanVliet(float sigma)
+{
+    double q;
+    if (sigma >= 2.5f)
+        q = 0.98711 * sigma - 0.96330;
+    else
+        q = 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+    double q2 = q * q;
+    double q3 = q2 * q;
+    double b0 = 1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+
+    RecursiveCoeffs coeffs;
+    coeffs.a1 = (float)((2.44413*q + 2.85619*q2 + 1.26661*q3) / b0);
+    coeffs.a2 = (float)(-(1.4281*q2 + 1.26661*q3) / b0);
+    coeffs.a3 = (float)(0.422205*q3 / b0);
+    // unit gain for a constant signal
+    coeffs.b = 1.0f - (coeffs.a1 + coeffs.a2 + coeffs.a3);
+    return coeffs;
+}
+
+// The recursive and the box filters run down n rows of count floats. Each step is
+// a short ConvolveColumns() over whole rows, so the recursion is vectorized across
+// the columns. Rows outside [0, n) are the edge rows, as with a replicated border.
+
+// in place; with the edge rows as history the first and the last row stay as they are
+static void RecursiveColumns(float * const *ppRows, int n, int count, const RecursiveCoeffs &coeffs)
+{
+    const float kernel[4] = {coeffs.b, coeffs.a1, coeffs.a2, coeffs.a3};
+    for (int y = 1; y < n; ++y) {
+        const float *ppTaps[4] = {ppRows[y], ppRows[y-1], ppRows[max(y-2, 0)], ppRows[max(y-3, 0)]};
+        ConvolveColumns(ppTaps, kernel, 4, ppRows[y], count);
+    }
+    for (int y = n-2; y >= 0; --y) {
+        const float *ppTaps[4] = {ppRows[y], ppRows[y+1], ppRows[min(y+2, n-1)], ppRows[min(y+3, n-1)]};
+        ConvolveColumns(ppTaps, kernel, 4, ppRows[y], count);
+    }
+}
+
+// Running mean of 2*radius+1 rows, one row added and one removed per step. The sum
+// restarts from the full window every 2*radius+1 rows, which bounds the rounding drift.
+static void BoxColumns(const float * const *ppSrc, float * const *ppDst, int n, int count, int radius)
+{
+    int size = 2 * radius + 1;
+    float scale = 1.0f / size;
+    vector<float> mean(size, scale);
+    vector<const float*> window(size);
+    const float step[3] = {1.0f, scale, -scale};
+
+    for (int y = 0; y < n; ++y) {
+        if (y % size == 0) {
+            for (int k = 0; k < size; ++k)
+                window[k] = ppSrc[min(max(y-radius+k, 0), n-1)];
+            ConvolveColumns(window.data(), mean.data(), size, ppDst[y], count);
+        } else {
+            const float *ppTaps[3] = {ppDst[y-1], ppSrc[min(y+radius, n-1)], ppSrc[max(y-radius-1, 0)]};
+            ConvolveColumns(ppTaps, step, 3, ppDst[y], count);
+        }
+    }
+}
+
+// rows transposed together by the horizontal passes, every x becomes a row of 16*channel lanes
+static const int tileRows = 16;
+
+// Runs func(ppIn, ppOut, width, lanes) on tiles of rows of src transposed so that the
+// horizontal pass becomes a column pass, then transposes ppOut back into dst.
+// src and dst are unpadded FLOAT32 and may be the same image.
+template <typename F>
+static void ForTransposedTiles(const Image &src, Image &dst, bool inPlace, F func)
+{
+    int width = src.GetWidth();
+    int channel = src.GetChannel();
+    int count = width * channel;
+
+    ThreadPool::Shared().ParallelFor(0, src.GetHeight(), rowGrain, [&](int begin, int end) {
+        int lanesMax = tileRows * channel;
+        vector<float> tileIn((size_t)width * lanesMax);
+        vector<float> tileOut(inPlace ? 0 : (size_t)width * lanesMax);
+        vector<float*> ppIn(width), ppOut(width);
+
+        for (int y0 = begin; y0 < end; y0 += tileRows) {
+            int rows = min(tileRows, end - y0);
+            int lanes = rows * channel;
+            float *pOut = inPlace ? tileIn.data() : tileOut.data();
+            for (int x = 0; x < width; ++x) {
+                ppIn[x] = tileIn.data() + (size_t)x * lanes;
+                ppOut[x] = pOut + (size_t)x * lanes;
+            }
+
+            // the tile is written and read in order, the rows are the strided side
+            const float *ppSrc[tileRows];
+            float *ppDst[tileRows];
+            for (int r = 0; r < rows; ++r) {
+                ppSrc[r] = src.GetRow<float>(y0 + r);
+                ppDst[r] = dst.GetRow<float>(y0 + r);
             }
+            float *pTile = tileIn.data();
+            for (int i = 0; i < count; i += channel)
+                for (int r = 0; r < rows; ++r)
+                    for (int c = 0; c < channel; ++c)
+                        *pTile++ = ppSrc[r][i + c];
+            func(ppIn.data(), ppOut.data(), width, lanes);
+            pTile = pOut;
+            for (int i = 0; i < count; i += channel)
+                for (int r = 0; r < rows; ++r)
+                    for (int c = 0; c < channel; ++c)
+                        ppDst[r][i + c] = *pTile++;
+        }
+    });
+}
+
+// row pointers of the columns [begin, begin+count) of every row
+static void ColumnBand(Image &image, int begin, vector<float*> &ppRows)
+{
+    ppRows.resize(image.GetHeight());
+    for (int y = 0; y < image.GetHeight(); ++y)
+        ppRows[y] = image.GetRow<float>(y) + begin;
+}
+
+CVError Image::RecursiveGaussianBlur(Image &g, float sigma) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (IsEmpty() || sigma <= 0.0f) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // the approximation is only fitted from sigma 0.5 on, the exact kernel is small there anyway
+    if (sigma < 0.5f)
+        return GaussianBlur(g, sigma);
+
+    // in place, a shared buffer is copied before the bands and the plane views write into it
+    if (&g == this) {
+        status = g.Detach();
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // in place, the planes of g are the planes of this image
+    if (IsPlanar()) {
+        if (&g != this) {
+            status = g.AllocatePlanar(mWidth, mHeight, mChannel);
+            SHOW_ERROR_AND_RETURN(status);
         }
+        bool inPlace = (&g == this);
+        return ForEachPlane(*this, g, [&](int, const Image &src, Image &dst) {
+            return inPlace ? dst.RecursiveGaussianBlur(dst, sigma) : src.RecursiveGaussianBlur(dst, sigma);
+        });
+    }
+
+    if (&g != this) {
+        status = g.Allocate(mWidth, mHeight, mChannel, ImageType::FLOAT32);
+        SHOW_ERROR_AND_RETURN(status);
+    } else if (mType != ImageType::FLOAT32 || mBorder != 0) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    RecursiveCoeffs coeffs = YoungVanVliet(sigma);
+    int count = mWidth * mChannel;
+    ThreadPool &pool = ThreadPool::Shared();
+
+    if (&g != this) {
+        pool.ParallelFor(0, mHeight, rowGrain, [&](int begin, int end) {
+            for (int y = begin; y < end; ++y)
+                ConvertElements(GetRowData(y), mType, g.GetRow<float>(y), ImageType::FLOAT32, count, 1.0f, 0.0f);
+        });
+    }
+
+    // horizontal, in place in g
+    ForTransposedTiles(g, g, true, [&](float * const *ppIn, float * const *, int width, int lanes) {
+        RecursiveColumns(ppIn, width, lanes, coeffs);
+    });
+
+    // vertical, in place over bands of columns
+    pool.ParallelFor(0, count, 256, [&](int begin, int end) {
+        vector<float*> ppRows;
+        ColumnBand(g, begin, ppRows);
+        RecursiveColumns(ppRows.data(), mHeight, end - begin, coeffs);
+    });
+
+    return status;
+}
+
+// a box of width w has variance (w^2-1)/12, so sigma^2 takes w = sqrt(12*sigma^2+1). The
+// radius is rounded, the odd width 2*radius+1 is the one nearest to w.
+int BoxRadius(float sigma)
+{
+    int radius = (int)floor((sqrt(12.0 * sigma * sigma + 1.0) - 1.0) / 2.0 + 0.5);
+    return max(radius, 0);
+}
+
+CVError Image::BoxBlur(Image &g, int radius) const
+{
+    CVError status = CVError::NOERROR;
+
+    if (IsEmpty() || radius < 0 || &g == this) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    if (IsPlanar()) {
+        status = g.AllocatePlanar(mWidth, mHeight, mChannel);
+        SHOW_ERROR_AND_RETURN(status);
+        return ForEachPlane(*this, g, [&](int, const Image &src, Image &dst) { return src.BoxBlur(dst, radius); });
     }
 
+    status = g.Allocate(mWidth, mHeight, mChannel, ImageType::FLOAT32);
+    SHOW_ERROR_AND_RETURN(status);
+
+    Image filter1D;
+    filter1D.SetAllocator(g.GetAllocator());
+    status = filter1D.Allocate(mWidth, mHeight, mChannel);
+    SHOW_ERROR_AND_RETURN(status);
+
+    int count = mWidth * mChannel;
+    ThreadPool &pool = ThreadPool::Shared();
+
+    // the source as float in g, then horizontal from g into filter1D and vertical back into g
+    pool.ParallelFor(0, mHeight, rowGrain, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y)
+            ConvertElements(GetRowData(y), mType, g.GetRow<float>(y), ImageType::FLOAT32, count, 1.0f, 0.0f);
+    });
+
+    ForTransposedTiles(g, filter1D, false, [&](float * const *ppIn, float * const *ppOut, int width, int lanes) {
+        BoxColumns(ppIn, ppOut, width, lanes, radius);
+    });
+
+    pool.ParallelFor(0, count, 256, [&](int begin, int end) {
+        vector<float*> ppSrc, ppDst;
+        ColumnBand(filter1D, begin, ppSrc);
+        ColumnBand(g, begin, ppDst);
+        BoxColumns(ppSrc.data(), ppDst.data(), mHeight, end - begin, radius);
+    });
+
     return status;
 }
 
+CVError Image::Smooth(Image &g, float sigma, BlurMode mode) const
+{
+    switch (mode)
+    {
+    case BlurMode::RECURSIVE:
+        return RecursiveGaussianBlur(g, sigma);
+    case BlurMode::BOX:
+        return BoxBlur(g, BoxRadius(sigma));
+    case BlurMode::GAUSSIAN:
+    default:
+        return GaussianBlur(g, sigma);
+    }
+}
+
 void Image::DrawPoint(int x, int y, float r, float g, float b, int size)
 {
+    if (IsEmpty() || Detach() != CVError::NOERROR)
+        return;
+
     for (int i = x-size/2; i <= x+size/2; i++) {
         for (int j = y-size/2; j <= y+size/2; j++) {
             if (i < 0 || i >= mWidth) continue;
             if (j < 0 || j >= mHeight) continue;
             if (abs(i-x) + abs(j-y) > size/2) continue;
             if (mChannel == 3) {
-                SetPixel(i, j, 0, r);
-                SetPixel(i, j, 1, g);
-                SetPixel(i, j, 2, b);
+                WritePixel(i, j, 0, r);
+                WritePixel(i, j, 1, g);
+                WritePixel(i, j, 2, b);
             } else if (mChannel == 1) {
-                SetPixel(i, j, 0, r);
+                WritePixel(i, j, 0, r);
             }
         }
     }
@@ -508,6 +1864,9 @@ void Image::DrawPoint(int x, int y, float r, float g, float b, int size)
 
 void Image::DrawLine(int x1, int y1, int x2, int y2,  float r, float g, float b)
 {
+    if (IsEmpty() || Detach() != CVError::NOERROR)
+        return;
+
     if (x2 < x1) {
         swap(x1, x2);
         swap(y1, y2);
@@ -516,11 +1875,11 @@ void Image::DrawLine(int x1, int y1, int x2, int y2,  float r, float g, float b)
     for (int x = x1; x < x2; x++) {
         int y = y1 + dy*(x-x1)/dx;
         if (mChannel == 3) {
-            SetPixel(x, y, 0, r);
-            SetPixel(x, y, 1, g);
-            SetPixel(x, y, 2, b);
+            WritePixel(x, y, 0, r);
+            WritePixel(x, y, 1, g);
+            WritePixel(x, y, 2, b);
         } else {
-            SetPixel(x, y, 0, r);
+            WritePixel(x, y, 0, r);
         }
     }
 }
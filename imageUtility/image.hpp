@@ -2,14 +2,116 @@
 #define __IMAGE_HPP__
 
 #include "cvError.hpp"
+#include "bufferPool.hpp"
+#include <atomic>
+#include <cstddef>
+#include <vector>
 
 namespace shun {
 
+    // element type of the pixel storage
+    enum class ImageType : int {
+        UINT8 = 0,
+        UINT16,
+        FLOAT32,
+    };
+
+    // round to nearest and clamp to the range of an integer element type
+    template <typename T> inline T SaturateCast(float value);
+
+    template <> inline unsigned char SaturateCast<unsigned char>(float value)
+    {
+        value += 0.5f;
+        return (value <= 0.0f) ? 0 : (value >= 255.0f) ? 255 : (unsigned char)value;
+    }
+
+    template <> inline unsigned short SaturateCast<unsigned short>(float value)
+    {
+        value += 0.5f;
+        return (value <= 0.0f) ? 0 : (value >= 65535.0f) ? 65535 : (unsigned short)value;
+    }
+
+    template <> inline float SaturateCast<float>(float value)
+    {
+        return value;
+    }
+
+    // one row of interleaved RGB to gray, the element type is kept
+    template <typename T>
+    inline void RGB2GrayRow(const T *pSrc, T *pDst, int width)
+    {
+        for (int x = 0; x < width; ++x) {
+            pDst[x] = SaturateCast<T>(
+                0.144f * pSrc[3*x+0] +
+                0.587f * pSrc[3*x+1] +
+                0.299f * pSrc[3*x+2]);
+        }
+    }
+
+    // the same from the three planes of a planar image
+    template <typename T>
+    inline void RGB2GrayRow(const T *pSrc0, const T *pSrc1, const T *pSrc2, T *pDst, int width)
+    {
+        for (int x = 0; x < width; ++x)
+            pDst[x] = SaturateCast<T>(0.144f * pSrc0[x] + 0.587f * pSrc1[x] + 0.299f * pSrc2[x]);
+    }
+
+    // libjpeg decode settings, the defaults decode at full size in the file's color space
+    struct JpegReadParam {
+            JpegReadParam(): gray{0}, scaleDenom{1}, fastIdct{0}, fancyUpsampling{1} {}
+
+            int gray;            // 1: libjpeg outputs 1-channel gray, the chroma is never decoded
+            int scaleDenom;      // 1, 2, 4 or 8: the IDCT scales the image down by 1/scaleDenom
+            int fastIdct;        // 1: fast integer IDCT (JDCT_IFAST), slightly less accurate
+            int fancyUpsampling; // 0: replicate the chroma instead of interpolating it
+    };
+
+    // libjpeg encode settings
+    struct JpegWriteParam {
+            JpegWriteParam(): quality{80}, fastDct{0}, optimizeCoding{0}, fancyDownsampling{1} {}
+
+            int quality;           // [0 - 100]
+            int fastDct;           // 1: fast integer forward DCT (JDCT_IFAST)
+            int optimizeCoding;    // 1: optimal Huffman tables, smaller files but an extra pass
+            int fancyDownsampling; // 0: plain averaging of the chroma (libjpeg 7 and later)
+    };
+
+    // how the channels of the pixels are stored
+    enum class ImageLayout : int {
+        INTERLEAVED = 0,    // channel c of pixel x is element x*channel + c of its row
+        PLANAR,             // every channel is a contiguous 1-channel plane, see GetPlane()
+    };
+
+    // how Smooth() approximates a Gaussian of a given sigma
+    enum class BlurMode : int {
+        GAUSSIAN = 0,   // exact separable kernel of ceil(6*sigma) taps
+        RECURSIVE,      // recursive (IIR) Gaussian
+        BOX,            // box of about the same variance, see BoxRadius()
+    };
+
+    // The start of every image buffer, the pixels follow at BufferHeaderBytes. Copies of an
+    // image share its buffer, which goes back to the allocator it came from when the last of
+    // them releases it.
+    struct ImageBufferHeader {
+            std::atomic<int> mRefCount;     // images sharing the buffer
+            std::atomic<int> mPinned;       // 1 once a view was taken, copies get their own pixels from then on
+            size_t mBytes;                  // bytes asked from mpAllocator, the header included
+            ImageAllocator *mpAllocator;
+    };
+
+    static const size_t BufferHeaderBytes = ImageAllocator::Alignment;
+    static_assert(sizeof(ImageBufferHeader) <= BufferHeaderBytes, "image buffer header size");
+
+    // A copy of an image that owns its pixels shares them, so read-only pipelines pay for no copy.
+    // Allocate() of a shared image takes a new buffer, and everything that may write in place
+    // detaches it first: SetPixel(), FillBorder(), Draw*(), a filter with g == this and the non-const
+    // GetData(), GetRow(), GetPlane() and GetRowData(). Read a shared image through a const
+    // reference, the non-const accessors copy it. Copies may be read and released on different threads.
     class Image {
         public:
             // construct/destruct
             Image();
-            Image(int width, int height, int channel);
+            Image(int width, int height, int channel, ImageType type = ImageType::FLOAT32);
             Image(const Image &rhs);
             Image(Image &&rhs);
             Image& operator=(const Image &rhs);
@@ -17,44 +119,192 @@ namespace shun {
             virtual ~Image();
 
             // data access
-            CVError Allocate(int width, int height, int channel, int freeMemory = 1);
+            CVError Allocate(int width, int height, int channel, ImageType type = ImageType::FLOAT32, int freeMemory = 1);
+            // allocate with border pixels of padding on every side, see FillBorder()
+            CVError AllocatePadded(int width, int height, int channel, int border, ImageType type = ImageType::FLOAT32);
+            // allocate channel planes of width x height one after the other
+            CVError AllocatePlanar(int width, int height, int channel, ImageType type = ImageType::FLOAT32);
             void Release();
+            // buffers come from allocator from now on, e.g. a BufferPool. Releases the pixels
+            // if the allocator changes, nullptr restores ImageAllocator::Default().
+            void SetAllocator(ImageAllocator *pAllocator);
+            ImageAllocator* GetAllocator() const { return mpAllocator; }
             int GetWidth() const { return mWidth; }
             int GetHeight() const { return mHeight; }
             int GetChannel() const { return mChannel; }
             int GetSize() const { return mSize; }
-            float* GetData() { return mData; }
+            int GetStride() const { return mStride; }   // elements between two rows
+            int GetBorder() const { return mBorder; }
+            // pixels of the parent image beyond each edge of a view, 0 for an image owning its
+            // pixels. Sobel() and GaussianBlur() read them instead of replicating the edge.
+            int GetMarginLeft() const { return mMarginLeft; }
+            int GetMarginTop() const { return mMarginTop; }
+            int GetMarginRight() const { return mMarginRight; }
+            int GetMarginBottom() const { return mMarginBottom; }
+            ImageType GetType() const { return mType; }
+            ImageLayout GetLayout() const { return mLayout; }
+            // a 1-channel image is the same in both layouts and is never planar
+            int IsPlanar() const { return (mLayout == ImageLayout::PLANAR && mChannel > 1) ? 1 : 0; }
+            size_t GetPlaneStride() const { return mPlaneStride; }  // elements between two planes
+            int GetElemSize() const { return ElemSize(mType); }
+            void* GetData() { if (IsShared()) Detach(); return mData; }   // nullptr if the detach fails
+            const void* GetData() const { return mData; }
+            template <typename T> T* GetData() { return static_cast<T*>(GetData()); }
+            template <typename T> const T* GetData() const { return static_cast<const T*>(mData); }
+            // pointer to pixel (0, y), y and x may reach into the border: [-border, size+border)
+            template <typename T> T* GetRow(int y) { return GetData<T>() + (ptrdiff_t)y * mStride; }
+            template <typename T> const T* GetRow(int y) const { return GetData<T>() + (ptrdiff_t)y * mStride; }
+            // pixel (0, 0) of the plane of channel of a planar image, rows are GetStride() apart
+            template <typename T> T* GetPlane(int channel) { return GetData<T>() + channel * mPlaneStride; }
+            template <typename T> const T* GetPlane(int channel) const { return GetData<T>() + channel * mPlaneStride; }
+            void* GetRowData(int y) { return GetRow<unsigned char>(0) + (ptrdiff_t)y * mStride * ElemSize(mType); }
+            const void* GetRowData(int y) const { return GetRow<unsigned char>(0) + (ptrdiff_t)y * mStride * ElemSize(mType); }
+            // replicate the edge pixels into the padding, matching the clamp of GetPixel()
+            void FillBorder();
             float GetPixel(int x, int y, int channel) const;
             void SetPixel(int x, int y, int channel, float value);
             void SetDebug(int value) { mDebug = value; }
             int IsEmpty() const { return (mData == nullptr) ? 1 : 0; }
+            int IsView() const { return (mBuffer == nullptr && mData != nullptr) ? 1 : 0; }
+            // 1 while another image shares the pixels, or for a view of a shared image
+            int IsShared() const
+            {
+                return (mSharedView || (mBuffer != nullptr &&
+                        static_cast<const ImageBufferHeader*>(mBuffer)->mRefCount.load(std::memory_order_acquire) > 1)) ? 1 : 0;
+            }
+            // copies the pixels of a shared image into a buffer of its own, a shared view becomes a
+            // compact image. Nothing to do otherwise. MEMORY and empty if the copy fails.
+            CVError Detach();
+
+            // Makes view a non-owning window of width x height pixels at (x, y) of this image.
+            // The rectangle may reach into the margins. The view shares the pixels and the row
+            // stride, writing through it changes this image, and it must not outlive it.
+            // A copy of a view is a compact image that owns its pixels.
+            // A buffer that had a view taken is not shared again, its later copies get their own
+            // pixels, so the view never goes stale. The non-const overload detaches a shared image
+            // first. The const one can not, its view of a shared image is shared itself: reading it
+            // is fine, Detach() or Allocate() it before writing.
+            CVError GetView(Image &view, int x, int y, int width, int height);
+            CVError GetView(Image &view, int x, int y, int width, int height) const;
+            // view becomes the 1-channel plane of channel of a planar image, or the image itself if it
+            // has one channel, with the sharing rules of GetView(). Allocating a view of its own size,
+            // channel and type keeps it, so the filters can write into a plane or a window of a larger image.
+            CVError GetPlaneView(Image &view, int channel);
+            CVError GetPlaneView(Image &view, int channel) const;
+
+            // layout conversions, the source may have either layout
+            CVError Interleave(Image &image) const;
+            CVError Deinterleave(Image &image) const;
 
-            // use libjpeg to read/write a jpeg image
+            // use libjpeg to read/write a jpeg image, decoded images are UINT8
             CVError ReadJpegImage(const char *pName);
+            CVError ReadJpegImage(const char *pName, const JpegReadParam &param);
+            // decode from a compressed JPEG in memory, pData is only read
+            CVError ReadJpegImage(const unsigned char *pData, size_t size, const JpegReadParam &param = JpegReadParam());
+            // decode a memory-mapped file, no read() copy of the compressed data
+            CVError ReadJpegImageMapped(const char *pName, const JpegReadParam &param = JpegReadParam());
             CVError WriteJpegImage(const char *pName, int quality = 80) const;
+            CVError WriteJpegImage(const char *pName, const JpegWriteParam &param) const;
+            // encode into buffer, resized to the compressed size, its capacity is reused
+            CVError WriteJpegImage(std::vector<unsigned char> &buffer, const JpegWriteParam &param = JpegWriteParam()) const;
 
             // image transform
-            CVError RGB2Gray(Image &image) const;
+            // dst = saturate(src * alpha + beta), rounded to nearest for integer types
+            CVError ConvertTo(Image &image, ImageType type, float alpha = 1.0f, float beta = 0.0f) const;
+            CVError RGB2Gray(Image &image) const;   // keeps the element type, a 1-channel image is shared
+            // per channel min and max in one pass over the pixels, NaNs are skipped
+            CVError MinMax(std::vector<float> &min, std::vector<float> &max) const;
+            // maps every channel's [min, max] to [lowerBoundary, upperBoundary]
             CVError Normalize(Image &image, float lowerBoundary, float upperBoundary) const;
 
-            // image filter
+            // image filter, the results are always FLOAT32 in the layout of the source, planar images are
+            // filtered plane by plane. Sobel() and GaussianBlur() of a view read
+            // the parent's pixels around it, so tiles match the full frame; the recursive and box
+            // blurs replicate the view's edges.
             CVError Sobel(Image &dX, Image &dY) const;
+            // the 3x3 Scharr derivative, [3 10 3] across the central difference, more rotation invariant than Sobel
+            CVError Scharr(Image &dX, Image &dY) const;
             CVError GaussianBlur(Image &g, float sigma) const;
+            // Young-van Vliet IIR Gaussian, the cost does not depend on sigma. g may be this image
+            // if it is unpadded FLOAT32.
+            CVError RecursiveGaussianBlur(Image &g, float sigma) const;
+            // mean of the (2*radius+1)^2 window from running sums, the cost does not depend on radius
+            CVError BoxBlur(Image &g, int radius) const;
+            CVError Smooth(Image &g, float sigma, BlurMode mode) const;
 
             // draw
             void DrawPoint(int x, int y, float r, float g, float b, int size);
             void DrawLine(int x1, int y1, int x2, int y2, float r, float g, float b);
         
+            static int ElemSize(ImageType type);
+
         protected:
             void Init();
+            CVError AllocateBuffer(int width, int height, int channel, int border, ImageType type, int freeMemory,
+                                   ImageLayout layout = ImageLayout::INTERLEAVED);
+            void CopyPixels(const Image &rhs);
+            size_t GetBufferBytes() const;
+            // marks the buffer viewed, 1 if the view has to count as shared
+            int PinForView() const;
+            void WritePixel(int x, int y, int channel, float value);
 
             int mWidth;
             int mHeight;
             int mChannel;
             int mSize;
+            int mStride;
+            int mBorder;
+            int mMarginLeft;
+            int mMarginTop;
+            int mMarginRight;
+            int mMarginBottom;
             int mDebug;
-            float *mData;
+            int mSharedView;        // a view of a buffer that was shared when the view was taken
+            ImageType mType;
+            ImageLayout mLayout;
+            size_t mPlaneStride;    // 0 for an interleaved image
+            void *mBuffer;  // start of the allocation, an ImageBufferHeader and the border, nullptr for a view
+            void *mData;    // pixel (0, 0)
+            size_t mBufferBytes;    // bytes of mBuffer, the header included
+            ImageAllocator *mpAllocator;    // where the next buffer of this image comes from
     };
+
+    struct JpegScanlineSource;
+
+    // Decodes a JPEG file a few scanlines at a time, for images too large to hold decoded.
+    // Only libjpeg's state and the caller's rows are in memory while reading.
+    class JpegScanlineReader {
+        public:
+            JpegScanlineReader(): mpSource{nullptr}, mWidth{0}, mHeight{0}, mChannel{0}, mNextRow{0} {}
+            virtual ~JpegScanlineReader() { Close(); }
+
+            // reads the header and starts the decompression, the size is known afterwards
+            CVError Open(const char *pName, const JpegReadParam &param = JpegReadParam());
+            // decodes the next count rows into ppRows, GetWidth()*GetChannel() bytes each. rows is
+            // the number decoded, less than count only at the end of the image. An error closes the reader.
+            CVError ReadRows(unsigned char **ppRows, int count, int &rows);
+            void Close();
+
+            int GetWidth() const { return mWidth; }
+            int GetHeight() const { return mHeight; }
+            int GetChannel() const { return mChannel; }
+            int GetNextRow() const { return mNextRow; }   // rows decoded so far
+
+        private:
+            JpegScanlineReader(const JpegScanlineReader&) = delete;
+            JpegScanlineReader &operator=(const JpegScanlineReader&) = delete;
+
+            JpegScanlineSource *mpSource;   // libjpeg's state, kept out of this header
+            int mWidth;
+            int mHeight;
+            int mChannel;
+            int mNextRow;
+    };
+
+    // normalized 1D Gaussian of size ceil(6*sigma) rounded up to odd, stored as a FLOAT32 row
+    CVError GaussianKernel(Image &kernel, int &size, int &center, float sigma);
+    // radius of the odd-width box window whose width is nearest to that of a box of variance sigma^2
+    int BoxRadius(float sigma);
 }
 
 #endif  // __IMAGE_HPP__
@@ -0,0 +1,109 @@
+#include "profiler.hpp"
+#include <chrono>
+#include <cstdio>
+
+using namespace std;
+
+namespace shun {
+
+atomic<bool> Profiler::sEnabled{false};
+thread_local long long Profiler::tAllocBytes = 0;
+
+static long long SteadyNow()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static const long long sEpoch = SteadyNow();
+static atomic<int> sThreadCount{0};
+
+Profiler& Profiler::Shared()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+void Profiler::Enable(int enable)
+{
+    sEnabled.store(enable != 0, memory_order_relaxed);
+}
+
+void Profiler::Clear()
+{
+    lock_guard<mutex> lock(mMutex);
+    mEvents.clear();
+    mDropped = 0;
+}
+
+void Profiler::GetEvents(vector<ProfileEvent> &events) const
+{
+    lock_guard<mutex> lock(mMutex);
+    events = mEvents;
+}
+
+size_t Profiler::GetDroppedCount() const
+{
+    lock_guard<mutex> lock(mMutex);
+    return mDropped;
+}
+
+void Profiler::Record(const ProfileEvent &event)
+{
+    lock_guard<mutex> lock(mMutex);
+    if (mEvents.size() < mMaxEvents)
+        mEvents.push_back(event);
+    else
+        ++mDropped;
+}
+
+long long Profiler::Now()
+{
+    return SteadyNow() - sEpoch;
+}
+
+int Profiler::GetThreadId()
+{
+    static thread_local int id = ++sThreadCount;
+    return id;
+}
+
+void Profiler::WriteChromeTrace(string &json) const
+{
+    vector<ProfileEvent> events;
+    GetEvents(events);
+
+    // timestamps are in microseconds, the names are literals that need no escaping
+    char line[256];
+    json = "{\"traceEvents\":[\n";
+    for (size_t i = 0; i < events.size(); ++i) {
+        const ProfileEvent &event = events[i];
+        snprintf(line, sizeof(line),
+                 "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%lld}}%s\n",
+                 event.mName, event.mThread, event.mStart / 1000.0, event.mDuration / 1000.0, event.mBytes,
+                 (i + 1 < events.size()) ? "," : "");
+        json += line;
+    }
+    json += "],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+CVError Profiler::WriteChromeTrace(const char *pName) const
+{
+    CVError status = CVError::NOERROR;
+
+    FILE *pFile = fopen(pName, "w");
+    if (pFile == nullptr) {
+        status = CVError::FILEACCESS;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    string json;
+    WriteChromeTrace(json);
+    if (fwrite(json.data(), 1, json.size(), pFile) != json.size())
+        status = CVError::FILEACCESS;
+    fclose(pFile);
+    SHOW_ERROR_AND_RETURN(status);
+
+    return status;
+}
+
+}
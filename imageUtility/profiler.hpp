@@ -0,0 +1,96 @@
+#ifndef __PROFILER_HPP__
+#define __PROFILER_HPP__
+
+#include "cvError.hpp"
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace shun {
+
+    // one timed scope, see ProfileScope
+    struct ProfileEvent {
+            const char *mName;      // a string literal
+            int mThread;            // small id of the recording thread, from 1
+            long long mStart;       // ns since the program started
+            long long mDuration;    // ns
+            long long mBytes;       // image buffer bytes the thread allocated inside the scope, nested scopes included
+    };
+
+    // Collects the ProfileScope events of all threads while enabled. Off by default, then
+    // a scope costs one relaxed atomic load and nothing is recorded or counted.
+    class Profiler {
+        public:
+            static Profiler& Shared();
+            static bool IsEnabled() { return sEnabled.load(std::memory_order_relaxed); }
+
+            // the events are kept over disabling until Clear()
+            void Enable(int enable);
+            void Clear();
+            void GetEvents(std::vector<ProfileEvent> &events) const;
+            size_t GetDroppedCount() const;     // events not kept beyond mMaxEvents
+            // trace-event JSON for chrome://tracing and Perfetto, one complete ("X") event per scope
+            CVError WriteChromeTrace(const char *pName) const;
+            void WriteChromeTrace(std::string &json) const;
+
+            void Record(const ProfileEvent &event);
+            static long long Now();             // ns since the program started
+            static int GetThreadId();
+            // image buffers count themselves here, only while enabled
+            static void CountAllocation(size_t bytes) { tAllocBytes += (long long)bytes; }
+            static long long GetAllocatedBytes() { return tAllocBytes; }
+
+            size_t mMaxEvents;  // events kept until Clear(), the rest are dropped
+
+        protected:
+            Profiler(): mMaxEvents{1 << 20}, mDropped{0} {}
+
+            static std::atomic<bool> sEnabled;
+            static thread_local long long tAllocBytes;
+
+            std::vector<ProfileEvent> mEvents;
+            size_t mDropped;
+            mutable std::mutex mMutex;
+    };
+
+    // Records the time and allocations from construction to destruction, or to Next(),
+    // which closes the scope and opens the next stage under another name.
+    class ProfileScope {
+        public:
+            explicit ProfileScope(const char *pName) { Start(pName); }
+            ProfileScope(const ProfileScope &rhs) = delete;
+            ProfileScope& operator=(const ProfileScope &rhs) = delete;
+            ~ProfileScope() { Stop(); }
+
+            void Next(const char *pName) { Stop(); Start(pName); }
+            void Stop()
+            {
+                if (mpName) {
+                    ProfileEvent event = {mpName, Profiler::GetThreadId(), mStart, Profiler::Now() - mStart,
+                                          Profiler::GetAllocatedBytes() - mBytes};
+                    Profiler::Shared().Record(event);
+                    mpName = nullptr;
+                }
+            }
+
+        protected:
+            void Start(const char *pName)
+            {
+                mpName = nullptr;
+                if (Profiler::IsEnabled()) {
+                    mpName = pName;
+                    mBytes = Profiler::GetAllocatedBytes();
+                    mStart = Profiler::Now();
+                }
+            }
+
+            const char *mpName;     // nullptr: not recording
+            long long mStart;
+            long long mBytes;
+    };
+
+}
+
+#endif // __PROFILER_HPP__
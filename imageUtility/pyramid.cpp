@@ -0,0 +1,117 @@
+#include "pyramid.hpp"
+#include "convolve.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+
+using namespace std;
+
+namespace shun {
+
+// only the even rows are filtered vertically; the horizontal pass runs over the whole
+// row with the vector kernels and every other pixel is kept
+template <typename T>
+static void PyramidDownRows(const Image &src, Image &dst)
+{
+    int width = src.GetWidth();
+    int height = src.GetHeight();
+    int channel = src.GetChannel();
+    int count = width * channel;
+
+    ThreadPool::Shared().ParallelFor(0, dst.GetHeight(), 16, [&](int begin, int end) {
+        vector<float> line((width + 4) * channel);
+        vector<float> filtered(count);
+        float *pLine = line.data() + 2*channel;
+        for (int y = begin; y < end; ++y) {
+            const T *ppRows[5];
+            for (int k = 0; k < 5; ++k)
+                ppRows[k] = src.GetRow<T>(min(max(2*y + k - 2, 0), height - 1));
+            ConvolveColumns<Binomial5>(ppRows, pLine, count);
+            ReplicateRowEdges(pLine, width, channel, 2);
+            ConvolveRow<Binomial5>(pLine, channel, filtered.data(), count);
+
+            T *pDst = dst.GetRow<T>(y);
+            for (int x = 0; x < dst.GetWidth(); ++x) {
+                for (int c = 0; c < channel; ++c)
+                    pDst[x*channel + c] = SaturateCast<T>(filtered[2*x*channel + c]);
+            }
+        }
+    });
+}
+
+CVError PyramidDown(const Image &src, Image &dst)
+{
+    CVError status = CVError::NOERROR;
+
+    if (src.IsEmpty() || &src == &dst) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    // a planar image is halved plane by plane
+    if (src.IsPlanar()) {
+        status = dst.AllocatePlanar((src.GetWidth() + 1) / 2, (src.GetHeight() + 1) / 2, src.GetChannel(), src.GetType());
+        SHOW_ERROR_AND_RETURN(status);
+        Image srcPlane, dstPlane;
+        for (int c = 0; c < src.GetChannel(); ++c) {
+            status = src.GetPlaneView(srcPlane, c);
+            SHOW_ERROR_AND_RETURN(status);
+            status = dst.GetPlaneView(dstPlane, c);
+            SHOW_ERROR_AND_RETURN(status);
+            status = PyramidDown(srcPlane, dstPlane);
+            SHOW_ERROR_AND_RETURN(status);
+        }
+        return status;
+    }
+
+    status = dst.Allocate((src.GetWidth() + 1) / 2, (src.GetHeight() + 1) / 2, src.GetChannel(), src.GetType());
+    SHOW_ERROR_AND_RETURN(status);
+
+    switch (src.GetType())
+    {
+    case ImageType::UINT8:
+        PyramidDownRows<unsigned char>(src, dst);
+        break;
+    case ImageType::UINT16:
+        PyramidDownRows<unsigned short>(src, dst);
+        break;
+    case ImageType::FLOAT32:
+    default:
+        PyramidDownRows<float>(src, dst);
+        break;
+    }
+
+    return status;
+}
+
+CVError Pyramid::Build(const Image &img, int levels)
+{
+    CVError status = CVError::NOERROR;
+
+    if (img.IsEmpty() || levels <= 0) {
+        status = CVError::INPUT;
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    int count = 1;
+    int width = img.GetWidth();
+    int height = img.GetHeight();
+    while (count < levels) {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        if (width < mMinSize || height < mMinSize)
+            break;
+        ++count;
+    }
+
+    // resize keeps the buffers of the levels that stay
+    mLevels.resize(count);
+    mLevels[0] = img;
+    for (int i = 1; i < count; ++i) {
+        status = PyramidDown(mLevels[i-1], mLevels[i]);
+        SHOW_ERROR_AND_RETURN(status);
+    }
+
+    return status;
+}
+
+}
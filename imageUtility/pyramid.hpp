@@ -0,0 +1,40 @@
+#ifndef __PYRAMID_HPP__
+#define __PYRAMID_HPP__
+
+#include "image.hpp"
+#include <vector>
+
+namespace shun {
+
+    // A Gaussian pyramid: level 0 is a copy of the source, every further level is
+    // the previous one blurred with the 5-tap binomial (sigma about 1) and decimated
+    // by 2, keeping the element type. Pixel (x, y) of level l lies at (x*2^l, y*2^l)
+    // of level 0. The levels are kept, so one build serves several detectors, and a
+    // rebuild with a frame of the same size reuses their buffers.
+    class Pyramid {
+        public:
+            Pyramid(): mMinSize{16} {}
+            virtual ~Pyramid() {}
+
+            // up to levels levels including level 0, fewer if a level would get smaller than mMinSize
+            CVError Build(const Image &img, int levels);
+            void Release() { mLevels.clear(); }
+
+            int GetLevelCount() const { return (int)mLevels.size(); }
+            const Image& GetLevel(int level) const { return mLevels[level]; }
+            // size of a pixel of level in pixels of level 0
+            int GetScale(int level) const { return 1 << level; }
+
+            int mMinSize;   // smallest width or height of a level
+
+        protected:
+            std::vector<Image> mLevels;
+    };
+
+    // dst = src blurred with [1 4 6 4 1]/16 in both directions and decimated by 2,
+    // the size is ((width+1)/2, (height+1)/2), the border is replicated
+    CVError PyramidDown(const Image &src, Image &dst);
+
+}
+
+#endif // __PYRAMID_HPP__
@@ -0,0 +1,147 @@
+#include "threadPool.hpp"
+#include <algorithm>
+#include <memory>
+
+using namespace std;
+
+namespace shun {
+
+ThreadPool::ThreadPool(int threads)
+{
+    if (threads <= 0)
+        threads = max((int)thread::hardware_concurrency(), 1);
+
+    mThreadCount = threads;
+    mStop = false;
+    // the calling thread is one of the workers
+    for (int i = 1; i < threads; ++i)
+        mWorkers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCondition.notify_all();
+    for (auto &worker : mWorkers)
+        worker.join();
+}
+
+void ThreadPool::WorkerLoop()
+{
+    for (;;) {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(mMutex);
+            mCondition.wait(lock, [this] { return mStop || !mTasks.empty(); });
+            if (mStop && mTasks.empty())
+                return;
+            task = move(mTasks.front());
+            mTasks.pop_front();
+        }
+        task();
+    }
+}
+
+bool ThreadPool::RunOneTask()
+{
+    function<void()> task;
+    {
+        lock_guard<mutex> lock(mMutex);
+        if (mTasks.empty())
+            return false;
+        task = move(mTasks.front());
+        mTasks.pop_front();
+    }
+    task();
+    return true;
+}
+
+int ThreadPool::GetBandCount(int count, int grain) const
+{
+    if (count <= 0)
+        return 0;
+    grain = max(grain, 1);
+    return max(min(mThreadCount, count / grain), 1);
+}
+
+void ThreadPool::ParallelBands(int bands, const function<void(int)> &func)
+{
+    if (bands <= 0)
+        return;
+    if (bands == 1 || mThreadCount <= 1) {
+        for (int band = 0; band < bands; ++band)
+            func(band);
+        return;
+    }
+
+    struct Sync {
+        mutex lock;
+        condition_variable done;
+        int pending;
+    };
+    auto sync = make_shared<Sync>();
+    sync->pending = bands - 1;
+
+    {
+        lock_guard<mutex> lock(mMutex);
+        for (int band = 1; band < bands; ++band) {
+            mTasks.emplace_back([sync, band, &func] {
+                func(band);
+                lock_guard<mutex> lock(sync->lock);
+                if (--sync->pending == 0)
+                    sync->done.notify_all();
+            });
+        }
+    }
+    mCondition.notify_all();
+
+    func(0);
+
+    // help with the queue until it is empty, then wait for the bands still running
+    for (;;) {
+        {
+            lock_guard<mutex> lock(sync->lock);
+            if (sync->pending == 0)
+                return;
+        }
+        if (!RunOneTask()) {
+            unique_lock<mutex> lock(sync->lock);
+            sync->done.wait(lock, [&sync] { return sync->pending == 0; });
+            return;
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(int begin, int end, int grain, const function<void(int, int)> &func)
+{
+    int count = end - begin;
+    int bands = GetBandCount(count, grain);
+
+    ParallelBands(bands, [&](int band) {
+        int bandBegin = begin + (int)((long long)count * band / bands);
+        int bandEnd = begin + (int)((long long)count * (band + 1) / bands);
+        func(bandBegin, bandEnd);
+    });
+}
+
+static mutex sharedMutex;
+static unique_ptr<ThreadPool> sharedPool;
+
+ThreadPool& ThreadPool::Shared()
+{
+    lock_guard<mutex> lock(sharedMutex);
+    if (!sharedPool)
+        sharedPool.reset(new ThreadPool());
+    return *sharedPool;
+}
+
+void ThreadPool::SetSharedThreadCount(int threads)
+{
+    lock_guard<mutex> lock(sharedMutex);
+    sharedPool.reset(new ThreadPool(threads));
+}
+
+}
@@ -0,0 +1,51 @@
+#ifndef __THREADPOOL_HPP__
+#define __THREADPOOL_HPP__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace shun {
+
+    // A fixed set of worker threads that run row bands of the image filters.
+    // The calling thread always works on the first band and then helps with
+    // queued tasks while it waits, so nested and concurrent calls cannot deadlock.
+    class ThreadPool {
+        public:
+            explicit ThreadPool(int threads = 0);   // 0: one per hardware thread
+            virtual ~ThreadPool();
+
+            int GetThreadCount() const { return mThreadCount; }
+
+            // number of bands ParallelFor() splits count rows into, each at least grain rows
+            int GetBandCount(int count, int grain) const;
+            // run func(band) for band in [0, bands) and wait for all of them
+            void ParallelBands(int bands, const std::function<void(int)> &func);
+            // run func(begin, end) over row bands of [begin, end) and wait for all of them. An image the
+            // bands write must not be shared, every band would detach it: Allocate() or Detach() it
+            // before the call. The images they only read are read through const references.
+            void ParallelFor(int begin, int end, int grain, const std::function<void(int, int)> &func);
+
+            // the pool the image filters and the detectors use
+            static ThreadPool& Shared();
+            // rebuild the shared pool, call it while no filter is running. 1 runs serially.
+            static void SetSharedThreadCount(int threads);
+
+        protected:
+            void WorkerLoop();
+            bool RunOneTask();
+
+            int mThreadCount;
+            bool mStop;
+            std::vector<std::thread> mWorkers;
+            std::deque<std::function<void()>> mTasks;
+            std::mutex mMutex;
+            std::condition_variable mCondition;
+    };
+
+}
+
+#endif // __THREADPOOL_HPP__
@@ -0,0 +1,326 @@
+#include "convolve.hpp"
+#include "fastDetect.hpp"
+#include "harrisDetect.hpp"
+#include "profiler.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using namespace shun;
+using namespace std;
+
+// every operator new is counted, the image buffers are counted by their allocator
+static atomic<size_t> heapAllocCount(0);
+
+void* operator new(size_t bytes)
+{
+    ++heapAllocCount;
+    void *p = malloc(bytes ? bytes : 1);
+    if (p == nullptr)
+        throw bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+struct Resolution {
+    const char *name;
+    int width;
+    int height;
+};
+
+static const Resolution resolutions[] = {
+    {"VGA", 640, 480},
+    {"HD", 1280, 720},
+    {"FHD", 1920, 1080},
+    {"4K", 3840, 2160},
+    {"8K", 7680, 4320},
+};
+
+struct BenchConfig {
+    BenchConfig(): minIterations{3}, maxIterations{20}, minSeconds{0.5}, pCsv{nullptr} {}
+
+    int minIterations;
+    int maxIterations;
+    double minSeconds;  // keep iterating until this much time is spent, up to maxIterations
+    FILE *pCsv;
+};
+
+// Runs func repeatedly and prints the median time, the throughput over the
+// pixels of one frame and the allocations of one call.
+template <typename F>
+static void Bench(const BenchConfig &config, const char *pOp, const char *pParam, const Resolution &res, F func)
+{
+    typedef chrono::steady_clock Clock;
+
+    // one untimed call to warm the caches and the pools
+    func();
+
+    vector<double> times;
+    times.reserve(config.maxIterations);
+    size_t heapAllocs = heapAllocCount;
+    size_t imageAllocs = ImageAllocator::Default().GetAllocCount();
+    double total = 0.0;
+    while ((int)times.size() < config.minIterations ||
+           ((int)times.size() < config.maxIterations && total < config.minSeconds)) {
+        Clock::time_point begin = Clock::now();
+        func();
+        double seconds = chrono::duration<double>(Clock::now() - begin).count();
+        times.push_back(seconds);
+        total += seconds;
+    }
+    int iterations = (int)times.size();
+    heapAllocs = heapAllocCount - heapAllocs;
+    imageAllocs = ImageAllocator::Default().GetAllocCount() - imageAllocs;
+
+    sort(times.begin(), times.end());
+    double median = times[iterations / 2];
+    double mpixels = (double)res.width * res.height / 1e6;
+
+    printf("%-22s %-10s %-4s %5dx%-5d %9.3f ms %9.3f ms %9.1f MP/s %8.1f %8.1f\n",
+           pOp, pParam, res.name, res.width, res.height, median * 1e3, times[0] * 1e3, mpixels / median,
+           (double)heapAllocs / iterations, (double)imageAllocs / iterations);
+    if (config.pCsv) {
+        fprintf(config.pCsv, "%s,%s,%s,%d,%d,%d,%.6f,%.6f,%.3f,%.2f,%.2f\n",
+                pOp, pParam, res.name, res.width, res.height, iterations, median * 1e3, times[0] * 1e3,
+                mpixels / median, (double)heapAllocs / iterations, (double)imageAllocs / iterations);
+        fflush(config.pCsv);
+    }
+}
+
+// a checkerboard of 32-pixel squares with shaded colors and noise, so the detectors find corners.
+// Another seed gives the same scene with other noise.
+static void MakeSyntheticImage(Image &image, int width, int height, unsigned int seed = 12345)
+{
+    image.Allocate(width, height, 3, ImageType::UINT8);
+    for (int y = 0; y < height; ++y) {
+        unsigned char *pRow = image.GetRow<unsigned char>(y);
+        for (int x = 0; x < width; ++x) {
+            int square = ((x >> 5) + (y >> 5)) & 1;
+            for (int c = 0; c < 3; ++c) {
+                seed = seed * 1664525u + 1013904223u;
+                int value = (square ? 190 : 60) + (int)((x + y*c) & 31) + (int)(seed >> 28);
+                pRow[3*x+c] = (unsigned char)min(value, 255);
+            }
+        }
+    }
+}
+
+// a quarter turn clockwise, (x, y) moves to (height-1-y, x)
+static void Rotate90(const Image &src, Image &dst)
+{
+    int channel = src.GetChannel();
+    dst.Allocate(src.GetHeight(), src.GetWidth(), channel, ImageType::UINT8);
+    for (int y = 0; y < dst.GetHeight(); ++y) {
+        unsigned char *pDst = dst.GetRow<unsigned char>(y);
+        for (int x = 0; x < dst.GetWidth(); ++x) {
+            const unsigned char *pSrc = src.GetRow<unsigned char>(src.GetHeight() - 1 - x) + y * channel;
+            for (int c = 0; c < channel; ++c)
+                pDst[x*channel + c] = pSrc[c];
+        }
+    }
+}
+
+// the share of the corners of expected that found has within 2 pixels
+static double Repeatability(const FeatureResult &expected, const FeatureResult &found)
+{
+    if (expected.Size() == 0)
+        return 0.0;
+    unordered_set<long long> points;
+    for (int i = 0; i < found.Size(); ++i)
+        points.insert(((long long)found.mY[i] << 32) | (unsigned int)found.mX[i]);
+    int repeated = 0;
+    for (int i = 0; i < expected.Size(); ++i) {
+        bool hit = false;
+        for (int dy = -2; dy <= 2 && !hit; ++dy) {
+            for (int dx = -2; dx <= 2 && !hit; ++dx)
+                hit = points.count(((long long)(expected.mY[i] + dy) << 32) | (unsigned int)(expected.mX[i] + dx)) > 0;
+        }
+        repeated += hit ? 1 : 0;
+    }
+    return 100.0 * repeated / expected.Size();
+}
+
+// Detects on the image, on the same scene with other noise and on its quarter turn, and prints
+// the share of the corners found again in the two. detect(image, result) runs one engine.
+template <typename F>
+static void PrintRepeatability(const char *pOp, const char *pParam, const Resolution &res,
+                               const Image &image, const Image &noisy, const Image &rotated, F detect)
+{
+    FeatureResult base, again, turned;
+    detect(image, base);
+    detect(noisy, again);
+    detect(rotated, turned);
+    // the corners of image where the quarter turn moves them
+    FeatureResult moved;
+    for (int i = 0; i < base.Size(); ++i)
+        moved.Add(image.GetHeight() - 1 - base.mY[i], base.mX[i], base.mResponse[i]);
+    printf("%-22s %-10s %-4s %5dx%-5d %9d corners, repeated: noise %5.1f%%, rotate90 %5.1f%%\n",
+           pOp, pParam, res.name, res.width, res.height, base.Size(), Repeatability(base, again),
+           Repeatability(moved, turned));
+}
+
+static void PrintUsage(const char *pName)
+{
+    printf("usage: %s [-s VGA,HD,FHD,4K,8K] [-i maxIterations] [-t threads] [-o results.csv] [-p trace.json]\n", pName);
+}
+
+int main(int argc, char **argv)
+{
+    BenchConfig config;
+    string sizes = "VGA,HD,FHD,4K,8K";
+    const char *pCsvName = nullptr;
+    const char *pTraceName = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-s") && i+1 < argc) {
+            sizes = argv[++i];
+        } else if (!strcmp(argv[i], "-i") && i+1 < argc) {
+            config.maxIterations = max(atoi(argv[++i]), 1);
+            config.minIterations = min(config.minIterations, config.maxIterations);
+        } else if (!strcmp(argv[i], "-t") && i+1 < argc) {
+            ThreadPool::SetSharedThreadCount(atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "-o") && i+1 < argc) {
+            pCsvName = argv[++i];
+        } else if (!strcmp(argv[i], "-p") && i+1 < argc) {
+            pTraceName = argv[++i];
+        } else {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (pCsvName) {
+        config.pCsv = fopen(pCsvName, "w");
+        if (config.pCsv == nullptr) {
+            printf("can not open %s\n", pCsvName);
+            return 1;
+        }
+        fprintf(config.pCsv, "op,param,resolution,width,height,iterations,median_ms,min_ms,mpix_per_s,heap_allocs,image_allocs\n");
+    }
+
+    printf("threads: %d, simd level: %d\n", ThreadPool::Shared().GetThreadCount(), (int)GetSimdLevel());
+    printf("%-22s %-10s %-4s %11s %12s %12s %14s %8s %8s\n",
+           "op", "param", "res", "size", "median", "min", "throughput", "heap", "image");
+
+    for (const Resolution &res : resolutions) {
+        if (("," + sizes + ",").find(string(",") + res.name + ",") == string::npos)
+            continue;
+
+        Image rgb, gray, grayFloat, out, outY;
+        vector<unsigned char> jpeg;
+        MakeSyntheticImage(rgb, res.width, res.height);
+        rgb.RGB2Gray(gray);
+        gray.ConvertTo(grayFloat, ImageType::FLOAT32);
+        rgb.WriteJpegImage(jpeg);
+
+        Bench(config, "ReadJpegImage", "mem", res, [&] { out.ReadJpegImage(jpeg.data(), jpeg.size()); });
+        Bench(config, "ReadJpegImage", "gray/2", res, [&] {
+            JpegReadParam param;
+            param.gray = 1;
+            param.scaleDenom = 2;
+            out.ReadJpegImage(jpeg.data(), jpeg.size(), param);
+        });
+        Bench(config, "WriteJpegImage", "q80", res, [&] { rgb.WriteJpegImage(jpeg); });
+        Bench(config, "RGB2Gray", "u8", res, [&] { rgb.RGB2Gray(out); });
+        // a copy shares the pixels until one of them is written
+        Bench(config, "Image copy", "u8x3", res, [&] { out = rgb; });
+        Bench(config, "RGB2Gray", "u8,1ch", res, [&] { gray.RGB2Gray(out); });
+        Bench(config, "ConvertTo", "u8->f32", res, [&] { gray.ConvertTo(out, ImageType::FLOAT32); });
+        Bench(config, "Sobel", "u8", res, [&] { gray.Sobel(out, outY); });
+        Bench(config, "Sobel", "f32", res, [&] { grayFloat.Sobel(out, outY); });
+        Bench(config, "Scharr", "u8", res, [&] { gray.Scharr(out, outY); });
+        const float sigmas[] = {1.0f, 2.0f, 4.0f, 8.0f};
+        for (float sigma : sigmas) {
+            char param[32];
+            snprintf(param, sizeof(param), "sigma=%g", sigma);
+            Bench(config, "GaussianBlur", param, res, [&] { gray.GaussianBlur(out, sigma); });
+            Bench(config, "RecursiveGaussianBlur", param, res, [&] { gray.RecursiveGaussianBlur(out, sigma); });
+            Bench(config, "BoxBlur", param, res, [&] { gray.BoxBlur(out, BoxRadius(sigma)); });
+        }
+        Bench(config, "Normalize", "f32", res, [&] { grayFloat.Normalize(out, 0.0f, 255.0f); });
+
+        // three channels interleaved against three contiguous planes
+        Image planar;
+        rgb.Deinterleave(planar);
+        Bench(config, "Deinterleave", "u8x3", res, [&] { rgb.Deinterleave(out); });
+        Bench(config, "Interleave", "u8x3", res, [&] { planar.Interleave(out); });
+        Bench(config, "GaussianBlur", "rgb,s=2", res, [&] { rgb.GaussianBlur(out, 2.0f); });
+        Bench(config, "GaussianBlur", "planar,s=2", res, [&] { planar.GaussianBlur(out, 2.0f); });
+
+        HarrisDetect harris;
+        HarrisParam param;
+        HarrisResult result;
+        HarrisWorkspace workspace;
+        param.nmsSize = 5;
+        Bench(config, "FindFeature", "fused", res, [&] { harris.FindFeature(rgb, param, result); });
+        Bench(config, "FindFeature", "workspace", res, [&] { harris.FindFeature(rgb, param, result, workspace); });
+        param.fixedPoint = 1;
+        Bench(config, "FindFeature", "fixed", res, [&] { harris.FindFeature(rgb, param, result, workspace); });
+        param.fixedPoint = 0;
+        Pyramid pyramid;
+        Bench(config, "Pyramid::Build", "gray,4", res, [&] { pyramid.Build(gray, 4); });
+        Bench(config, "FindFeature", "pyramid4", res, [&] { harris.FindFeature(pyramid, param, result, workspace); });
+
+        // a wide window, where the cost of the exact kernel shows
+        param.sigma = 6.0f;
+        Bench(config, "FindFeature", "sigma=6", res, [&] { harris.FindFeature(rgb, param, result, workspace); });
+        param.blurMode = BlurMode::RECURSIVE;
+        Bench(config, "FindFeature", "s=6,iir", res, [&] { harris.FindFeature(rgb, param, result, workspace); });
+        param.blurMode = BlurMode::BOX;
+        Bench(config, "FindFeature", "s=6,box", res, [&] { harris.FindFeature(rgb, param, result, workspace); });
+        param = HarrisParam();
+        param.nmsSize = 5;
+        harris.mFused = 0;
+        Bench(config, "FindFeature", "full", res, [&] { harris.FindFeature(rgb, param, result, workspace); });
+
+        // the same with the profiler recording, -p writes the trace of these calls
+        Profiler::Shared().Enable(1);
+        Bench(config, "FindFeature", "profiled", res, [&] { harris.FindFeature(rgb, param, result, workspace); });
+        Profiler::Shared().Enable(0);
+
+        // FAST against Harris on the same frames: speed, then the corners repeated under other
+        // noise and a quarter turn
+        FastDetect fast;
+        FastParam fastParam;
+        FastResult fastResult;
+        FastWorkspace fastWorkspace;
+        Bench(config, "FastDetect", "9,nms", res, [&] { fast.FindFeature(rgb, fastParam, fastResult, fastWorkspace); });
+        Bench(config, "FastDetect", "9,gray", res, [&] { fast.FindFeature(gray, fastParam, fastResult, fastWorkspace); });
+        fastParam.arc = 12;
+        Bench(config, "FastDetect", "12,nms", res, [&] { fast.FindFeature(rgb, fastParam, fastResult, fastWorkspace); });
+        fastParam.arc = 9;
+
+        Image noisy, rotated;
+        MakeSyntheticImage(noisy, res.width, res.height, 54321);
+        Rotate90(rgb, rotated);
+        param = HarrisParam();
+        param.nmsSize = 5;
+        harris.mFused = 1;
+        PrintRepeatability("FindFeature", "fused", res, rgb, noisy, rotated, [&](const Image &image, FeatureResult &corners) {
+            harris.FindFeature(image, param, corners, workspace);
+        });
+        PrintRepeatability("FastDetect", "9,nms", res, rgb, noisy, rotated, [&](const Image &image, FeatureResult &corners) {
+            fast.FindFeature(image, fastParam, corners, fastWorkspace);
+        });
+    }
+
+    if (pTraceName && CVError::NOERROR != Profiler::Shared().WriteChromeTrace(pTraceName))
+        printf("can not write %s\n", pTraceName);
+
+    if (config.pCsv)
+        fclose(config.pCsv);
+
+    return 0;
+}
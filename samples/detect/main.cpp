@@ -0,0 +1,318 @@
+#include "harrisBatch.hpp"
+#include "harrisStream.hpp"
+#include "keypointFile.hpp"
+#include "threadPool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+
+using namespace shun;
+using namespace std;
+
+static void PrintUsage(const char *pName)
+{
+    printf("usage: %s [options] <directory | glob | file.jpg | @list.txt>...\n"
+           "  -j threads           images in flight, decode and detection, default: hardware threads\n"
+           "  -t threads           row-band threads inside one detection, default 1\n"
+           "  -o dir               write <dir>/<name>.txt with the corners of every image\n"
+           "  -a                   also write <dir>/<name>.jpg with the corners drawn\n"
+           "  -b file              write the corners of all images to one binary keypoint file\n"
+           "  -q                   no line per image\n"
+           "  --sigma f            Gaussian sigma of the structure tensor, default 2\n"
+           "  --k f                Harris constant, default 0.04\n"
+           "  --thd n              threshold on the 0-255 response scale, default 200\n"
+           "  --raw-thd f          threshold on the raw response instead, the same for every image\n"
+           "  --nms n              non-maximum suppression window, default 0 (off)\n"
+           "  --max-corners n      keep the n strongest corners, default 0 (all)\n"
+           "  --grid n             grid cell size in pixels, default 0 (off)\n"
+           "  --grid-corners n     corners kept per grid cell\n"
+           "  --blur mode          gaussian, recursive or box, default gaussian\n"
+           "  --fixed              fixed-point pipeline for 8-bit input\n"
+           "  --stream             decode and search every image a few rows at a time, for images too\n"
+           "                       large to hold; needs --raw-thd, no -a, max-corners and grid are ignored\n", pName);
+}
+
+static bool HasJpegExtension(const string &name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == string::npos)
+        return false;
+    string ext = name.substr(dot + 1);
+    transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    return ext == "jpg" || ext == "jpeg";
+}
+
+// the JPEG files of a directory, sorted by name
+static bool ListDirectory(const string &path, vector<string> &files)
+{
+    DIR *pDir = opendir(path.c_str());
+    if (pDir == nullptr)
+        return false;
+    vector<string> names;
+    for (struct dirent *pEntry = readdir(pDir); pEntry != nullptr; pEntry = readdir(pDir)) {
+        if (HasJpegExtension(pEntry->d_name))
+            names.push_back(path + "/" + pEntry->d_name);
+    }
+    closedir(pDir);
+    sort(names.begin(), names.end());
+    files.insert(files.end(), names.begin(), names.end());
+    return true;
+}
+
+// a directory, a glob pattern, a @file with one name per line or a single file
+static bool AddInput(const string &arg, vector<string> &files)
+{
+    struct stat info;
+    if (arg[0] == '@') {
+        ifstream list(arg.substr(1));
+        if (!list)
+            return false;
+        string line;
+        while (getline(list, line)) {
+            if (!line.empty() && line[0] != '#')
+                files.push_back(line);
+        }
+        return true;
+    } else if (arg.find_first_of("*?[") != string::npos) {
+        glob_t matches;
+        if (glob(arg.c_str(), 0, nullptr, &matches) != 0)
+            return false;
+        for (size_t i = 0; i < matches.gl_pathc; ++i)
+            files.push_back(matches.gl_pathv[i]);
+        globfree(&matches);
+        return true;
+    } else if (stat(arg.c_str(), &info) == 0 && S_ISDIR(info.st_mode)) {
+        return ListDirectory(arg, files);
+    }
+    files.push_back(arg);
+    return true;
+}
+
+// <dir>/<file name without extension><ext>
+static string OutputName(const string &dir, const string &input, const char *pExt)
+{
+    size_t slash = input.rfind('/');
+    string name = (slash == string::npos) ? input : input.substr(slash + 1);
+    size_t dot = name.rfind('.');
+    if (dot != string::npos && dot > 0)
+        name = name.substr(0, dot);
+    return dir + "/" + name + pExt;
+}
+
+// one corner per line: x y response scale
+static bool WriteKeypoints(const string &name, const HarrisBatchResult &result)
+{
+    FILE *pFile = fopen(name.c_str(), "w");
+    if (pFile == nullptr)
+        return false;
+    const HarrisResult &corners = result.mResult;
+    fprintf(pFile, "# %dx%d, %d corners: x y response scale\n", result.mWidth, result.mHeight, corners.Size());
+    for (int i = 0; i < corners.Size(); ++i)
+        fprintf(pFile, "%d %d %g %d\n", corners.mX[i], corners.mY[i], corners.mResponse[i], corners.mScale[i]);
+    return fclose(pFile) == 0;
+}
+
+// every job streams whole files, one after another, the images are never held decoded
+static void StreamFiles(const vector<string> &inputs, const HarrisParam &param, int jobs,
+                        vector<HarrisBatchResult> &results)
+{
+    results.assign(inputs.size(), HarrisBatchResult());
+    atomic<int> next(0);
+    vector<thread> threads;
+    for (int j = 0; j < jobs; ++j) {
+        threads.emplace_back([&] {
+            HarrisStream stream;
+            for (int i = next++; i < (int)inputs.size(); i = next++) {
+                HarrisBatchResult &result = results[i];
+                chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+                result.mStatus = stream.FindFeature(inputs[i].c_str(), param, result.mResult);
+                result.mWidth = stream.GetWidth();
+                result.mHeight = stream.GetHeight();
+                result.mLatency = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+                result.mDetectTime = result.mLatency;
+            }
+        });
+    }
+    for (auto &worker : threads)
+        worker.join();
+}
+
+// nearest rank of sorted values, p in [0, 1]
+static double Percentile(const vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t rank = (size_t)(p * sorted.size() + 0.5);
+    return sorted[min(max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+static void PrintPercentiles(const char *pName, vector<double> &times)
+{
+    sort(times.begin(), times.end());
+    printf("%-8s p50 %8.2f ms  p90 %8.2f ms  p99 %8.2f ms  max %8.2f ms\n", pName,
+           Percentile(times, 0.5) * 1e3, Percentile(times, 0.9) * 1e3, Percentile(times, 0.99) * 1e3,
+           times.empty() ? 0.0 : times.back() * 1e3);
+}
+
+int main(int argc, char **argv)
+{
+    HarrisBatch batch;
+    HarrisParam param;
+    vector<string> inputs;
+    string outDir;
+    string binaryName;
+    int jobs = max((int)thread::hardware_concurrency(), 1);
+    int bandThreads = 1;
+    int annotate = 0;
+    int quiet = 0;
+    int stream = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i+1 < argc;
+        if (!strcmp(argv[i], "-j") && hasValue) {
+            jobs = max(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "-t") && hasValue) {
+            bandThreads = max(atoi(argv[++i]), 1);
+        } else if (!strcmp(argv[i], "-o") && hasValue) {
+            outDir = argv[++i];
+        } else if (!strcmp(argv[i], "-b") && hasValue) {
+            binaryName = argv[++i];
+        } else if (!strcmp(argv[i], "-a")) {
+            annotate = 1;
+        } else if (!strcmp(argv[i], "-q")) {
+            quiet = 1;
+        } else if (!strcmp(argv[i], "--sigma") && hasValue) {
+            param.sigma = (float)atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--k") && hasValue) {
+            param.k = (float)atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--thd") && hasValue) {
+            param.thd = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--raw-thd") && hasValue) {
+            param.rawThd = (float)atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--nms") && hasValue) {
+            param.nmsSize = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--max-corners") && hasValue) {
+            param.maxCorners = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--grid") && hasValue) {
+            param.gridSize = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--grid-corners") && hasValue) {
+            param.gridCorners = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--blur") && hasValue) {
+            string mode = argv[++i];
+            if (mode == "gaussian") {
+                param.blurMode = BlurMode::GAUSSIAN;
+            } else if (mode == "recursive") {
+                param.blurMode = BlurMode::RECURSIVE;
+            } else if (mode == "box") {
+                param.blurMode = BlurMode::BOX;
+            } else {
+                PrintUsage(argv[0]);
+                return 2;
+            }
+        } else if (!strcmp(argv[i], "--fixed")) {
+            param.fixedPoint = 1;
+        } else if (!strcmp(argv[i], "--stream")) {
+            stream = 1;
+        } else if (argv[i][0] == '-') {
+            PrintUsage(argv[0]);
+            return 2;
+        } else if (!AddInput(argv[i], inputs)) {
+            printf("can not read %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (inputs.empty() || param.sigma <= 0.0f || (annotate && outDir.empty()) ||
+        (stream && (annotate || param.rawThd <= 0.0f || param.blurMode != BlurMode::GAUSSIAN))) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    // an existing directory is fine
+    if (!outDir.empty())
+        mkdir(outDir.c_str(), 0755);
+
+    // whole images in parallel scale better than the row bands of one image
+    ThreadPool::SetSharedThreadCount(bandThreads);
+    batch.mDecodeThreads = jobs;
+    batch.mDetectThreads = jobs;
+    batch.mEncodeThreads = annotate ? jobs : 1;
+    batch.mQueueSize = 2 * jobs;
+
+    vector<string> outputs;
+    if (annotate) {
+        for (const string &input : inputs)
+            outputs.push_back(OutputName(outDir, input, ".jpg"));
+    }
+
+    vector<HarrisBatchResult> results;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    CVError status = CVError::NOERROR;
+    if (stream)
+        StreamFiles(inputs, param, jobs, results);
+    else
+        status = batch.Run(inputs, outputs, param, results);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+    if (status != CVError::NOERROR) {
+        printf("batch failed: %d\n", (int)status);
+        return 1;
+    }
+
+    // the images are named by their input path, failed ones are left out
+    KeypointWriter writer;
+    if (!binaryName.empty() && writer.Open(binaryName.c_str()) != CVError::NOERROR) {
+        printf("can not write %s\n", binaryName.c_str());
+        return 1;
+    }
+
+    int failed = 0;
+    double mpixels = 0.0;
+    vector<double> latencies, detectTimes;
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const HarrisBatchResult &result = results[i];
+        bool written = outDir.empty() || result.mStatus != CVError::NOERROR ||
+                       WriteKeypoints(OutputName(outDir, inputs[i], ".txt"), result);
+        if (result.mStatus != CVError::NOERROR || !written) {
+            ++failed;
+            printf("%s: %s %d\n", inputs[i].c_str(), written ? "error" : "can not write corners, error",
+                   (int)(written ? result.mStatus : CVError::FILEACCESS));
+            continue;
+        }
+        if (!binaryName.empty() &&
+            writer.Add(result.mResult, result.mWidth, result.mHeight, inputs[i]) != CVError::NOERROR) {
+            printf("can not write %s\n", binaryName.c_str());
+            return 1;
+        }
+        mpixels += (double)result.mWidth * result.mHeight / 1e6;
+        latencies.push_back(result.mLatency);
+        detectTimes.push_back(result.mDetectTime);
+        if (!quiet) {
+            printf("%s: %dx%d, %d corners, detect %.2f ms\n", inputs[i].c_str(), result.mWidth, result.mHeight,
+                   result.mResult.Size(), result.mDetectTime * 1e3);
+        }
+    }
+
+    if (!binaryName.empty() && writer.Close() != CVError::NOERROR) {
+        printf("can not write %s\n", binaryName.c_str());
+        return 1;
+    }
+
+    int done = (int)latencies.size();
+    printf("%d images, %d failed, %.3f s, %.1f images/s, %.1f MP/s, %d jobs x %d threads\n",
+           done, failed, seconds, done / seconds, mpixels / seconds, jobs, bandThreads);
+    PrintPercentiles("latency", latencies);
+    PrintPercentiles("detect", detectTimes);
+
+    return failed ? 1 : 0;
+}
@@ -12,11 +12,12 @@ int main()
 
     image.ReadJpegImage("../../images/chessboard.jpg");
     param.thd = 150;
+    param.nmsSize = 5;
     harris.mDebug = 1;
     harris.FindFeature(image, param, result);
 
-    for (auto keypoint : result.mCoord) {
-        image.DrawPoint(keypoint.first, keypoint.second, 255.0f, 0.0f, 0.0f, 5);
+    for (int i = 0; i < result.Size(); ++i) {
+        image.DrawPoint(result.mX[i], result.mY[i], 255.0f, 0.0f, 0.0f, 5);
     }
     image.WriteJpegImage("result.jpg");
 
@@ -0,0 +1,580 @@
+#include "convolve.hpp"
+#include "fastDetect.hpp"
+#include "harrisDetect.hpp"
+#include "harrisStream.hpp"
+#include "pyramid.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace shun;
+using namespace std;
+
+// Checks the exactness the library documents. Every check prints PASS or FAIL, and the exit
+// code is the number of failures:
+//   every SimdLevel gives the SCALAR result bit for bit
+//   the StaticKernel passes equal the runtime-kernel passes with the same taps
+//   fixed-point Harris corners lie within one pixel of the float ones
+//   HarrisStream finds the corners of HarrisDetect
+//   a copy of an Image shares its pixels until one of the two is written
+
+static int failures = 0;
+
+static void Check(bool ok, const char *pName, const char *pDetail = "")
+{
+    printf("%s %s %s\n", ok ? "PASS" : "FAIL", pName, pDetail);
+    if (!ok)
+        ++failures;
+}
+
+static const char* LevelName(SimdLevel level)
+{
+    static const char *names[] = {"SCALAR", "SSE41", "AVX2", "AVX512"};
+    return names[(int)level];
+}
+
+static const SimdLevel vectorLevels[] = {SimdLevel::SSE41, SimdLevel::AVX2, SimdLevel::AVX512};
+
+static mt19937 rng(12345);
+
+template <typename T>
+static void FillRandom(vector<T> &values, size_t count, T low, T high)
+{
+    uniform_int_distribution<long long> dist((long long)low, (long long)high);
+    values.resize(count);
+    for (T &value : values)
+        value = (T)dist(rng);
+}
+
+static void FillRandom(vector<float> &values, size_t count, float low, float high)
+{
+    uniform_real_distribution<float> dist(low, high);
+    values.resize(count);
+    for (float &value : values)
+        value = dist(rng);
+}
+
+static void FillRandom(Image &image, int width, int height, int channel, ImageType type)
+{
+    image.Allocate(width, height, channel, type);
+    uniform_int_distribution<int> dist(0, 255);
+    for (int y = 0; y < height; ++y) {
+        for (int i = 0; i < width * channel; ++i) {
+            if (type == ImageType::UINT8)
+                image.GetRow<unsigned char>(y)[i] = (unsigned char)dist(rng);
+            else
+                image.GetRow<float>(y)[i] = dist(rng) * 1.7f - 100.0f;
+        }
+    }
+}
+
+template <typename T>
+static void Append(vector<unsigned char> &out, const T *pData, size_t count)
+{
+    const unsigned char *pBytes = reinterpret_cast<const unsigned char*>(pData);
+    out.insert(out.end(), pBytes, pBytes + count * sizeof(T));
+}
+
+static void Append(vector<unsigned char> &out, const Image &image)
+{
+    for (int y = 0; y < image.GetHeight(); ++y)
+        Append(out, static_cast<const unsigned char*>(image.GetRowData(y)),
+               (size_t)image.GetWidth() * image.GetChannel() * image.GetElemSize());
+}
+
+// runs func at SCALAR and then at every vector level, func appends its output bytes to out.
+// A level the CPU lacks falls back to the best one it has, the name printed is the one used.
+template <typename F>
+static void CompareLevels(const char *pName, F func)
+{
+    SetSimdLevel(SimdLevel::SCALAR);
+    vector<unsigned char> ref;
+    func(ref);
+    for (SimdLevel level : vectorLevels) {
+        SetSimdLevel(level);
+        vector<unsigned char> out;
+        func(out);
+        Check(out == ref, pName, LevelName(GetSimdLevel()));
+    }
+    SetSimdLevel(SimdLevel::AVX512);
+}
+
+static void NormalizedKernel(vector<float> &kernel, int size)
+{
+    FillRandom(kernel, size, 0.0f, 1.0f);
+    float sum = 0.0f;
+    for (float tap : kernel)
+        sum += tap;
+    for (float &tap : kernel)
+        tap /= sum;
+}
+
+// an odd length, so the vector loops leave a tail at every level
+static const int passCount = 1037;
+
+static void TestSimdPasses()
+{
+    const int size = 7, center = 3;
+    vector<float> kernel;
+    NormalizedKernel(kernel, size);
+
+    vector<vector<float>> rowsF(size);
+    vector<vector<unsigned char>> rowsU8(size);
+    vector<vector<unsigned short>> rowsU16(size);
+    vector<const float*> ppF(size);
+    vector<const unsigned char*> ppU8(size);
+    vector<const unsigned short*> ppU16(size);
+    for (int k = 0; k < size; ++k) {
+        FillRandom(rowsF[k], passCount, -1000.0f, 1000.0f);
+        FillRandom<unsigned char>(rowsU8[k], passCount, 0, 255);
+        FillRandom<unsigned short>(rowsU16[k], passCount, 0, 65535);
+        ppF[k] = rowsF[k].data();
+        ppU8[k] = rowsU8[k].data();
+        ppU16[k] = rowsU16[k].data();
+    }
+    vector<float> padded;
+    FillRandom(padded, (size_t)(passCount + 2*center) * 3, -1000.0f, 1000.0f);
+
+    CompareLevels("ConvolveColumns float", [&](vector<unsigned char> &out) {
+        vector<float> dst(passCount);
+        ConvolveColumns(ppF.data(), kernel.data(), size, dst.data(), passCount);
+        Append(out, dst.data(), dst.size());
+    });
+    CompareLevels("ConvolveColumns uint8", [&](vector<unsigned char> &out) {
+        vector<float> dst(passCount);
+        ConvolveColumns(ppU8.data(), kernel.data(), size, dst.data(), passCount);
+        Append(out, dst.data(), dst.size());
+    });
+    CompareLevels("ConvolveColumns uint16", [&](vector<unsigned char> &out) {
+        vector<float> dst(passCount);
+        ConvolveColumns(ppU16.data(), kernel.data(), size, dst.data(), passCount);
+        Append(out, dst.data(), dst.size());
+    });
+    for (int channel : {1, 3}) {
+        CompareLevels(channel == 1 ? "ConvolveRow 1 channel" : "ConvolveRow 3 channels", [&](vector<unsigned char> &out) {
+            vector<float> dst((size_t)passCount * channel);
+            ConvolveRow(padded.data() + center*channel, channel, kernel.data(), size, center, dst.data(), passCount * channel);
+            Append(out, dst.data(), dst.size());
+        });
+    }
+
+    vector<float> withNan;
+    FillRandom(withNan, passCount, -1e6f, 1e6f);
+    for (size_t i = 0; i < withNan.size(); i += 97)
+        withNan[i] = numeric_limits<float>::quiet_NaN();
+    CompareLevels("MinMaxElements", [&](vector<unsigned char> &out) {
+        float min = numeric_limits<float>::max(), max = -numeric_limits<float>::max();
+        MinMaxElements(withNan.data(), passCount, min, max);
+        Append(out, &min, 1);
+        Append(out, &max, 1);
+    });
+}
+
+static void TestFixedPasses()
+{
+    Image gaussian;
+    int size, center;
+    GaussianKernel(gaussian, size, center, 2.0f);
+    vector<int> fixedKernel(size);
+    QuantizeKernel(gaussian.GetData<float>(), size, fixedKernel.data());
+
+    vector<vector<unsigned char>> gray(3);
+    vector<const unsigned char*> ppGray(3);
+    for (int k = 0; k < 3; ++k) {
+        FillRandom<unsigned char>(gray[k], passCount, 0, 255);
+        ppGray[k] = gray[k].data();
+    }
+    vector<short> fx, fy;
+    FillRandom<short>(fx, passCount + 2, -1020, 1020);
+    FillRandom<short>(fy, passCount + 2, -255, 255);
+
+    // the blur input stays below 2^20, the bound the header gives
+    const int limit = (1 << 20) - 1;
+    vector<vector<int>> tensor(size);
+    vector<const int*> ppTensor(size);
+    for (int k = 0; k < size; ++k) {
+        FillRandom<int>(tensor[k], passCount, -limit, limit);
+        ppTensor[k] = tensor[k].data();
+    }
+    vector<int> paddedTensor;
+    FillRandom<int>(paddedTensor, passCount + 2*center, -limit, limit);
+
+    CompareLevels("SobelColumnsFixed", [&](vector<unsigned char> &out) {
+        vector<short> dx(passCount), dy(passCount);
+        SobelColumnsFixed(ppGray.data(), dx.data(), dy.data(), passCount);
+        Append(out, dx.data(), dx.size());
+        Append(out, dy.data(), dy.size());
+    });
+    CompareLevels("SobelTensorFixed", [&](vector<unsigned char> &out) {
+        vector<int> xx(passCount), xy(passCount), yy(passCount);
+        SobelTensorFixed(fx.data() + 1, fy.data() + 1, xx.data(), xy.data(), yy.data(), passCount);
+        Append(out, xx.data(), xx.size());
+        Append(out, xy.data(), xy.size());
+        Append(out, yy.data(), yy.size());
+    });
+    CompareLevels("ConvolveColumnsFixed", [&](vector<unsigned char> &out) {
+        vector<int> dst(passCount);
+        ConvolveColumnsFixed(ppTensor.data(), fixedKernel.data(), size, FixedKernelShift, dst.data(), passCount);
+        Append(out, dst.data(), dst.size());
+    });
+    CompareLevels("ConvolveRowFixed", [&](vector<unsigned char> &out) {
+        vector<int> dst(passCount);
+        ConvolveRowFixed(paddedTensor.data() + center, fixedKernel.data(), size, center, FixedKernelShift, dst.data(), passCount);
+        Append(out, dst.data(), dst.size());
+    });
+}
+
+static void TestSimdImages(const Image &photo)
+{
+    Image gray, grayF, rgbF;
+    photo.RGB2Gray(gray);
+    FillRandom(grayF, 211, 97, 1, ImageType::FLOAT32);
+    FillRandom(rgbF, 131, 67, 3, ImageType::FLOAT32);
+
+    CompareLevels("Sobel", [&](vector<unsigned char> &out) {
+        Image dX, dY;
+        for (const Image *pImage : initializer_list<const Image*>{&gray, &grayF, &photo}) {
+            pImage->Sobel(dX, dY);
+            Append(out, dX);
+            Append(out, dY);
+        }
+    });
+    CompareLevels("GaussianBlur", [&](vector<unsigned char> &out) {
+        Image blurred;
+        for (float sigma : {0.8f, 2.0f, 3.5f}) {
+            grayF.GaussianBlur(blurred, sigma);
+            Append(out, blurred);
+            rgbF.GaussianBlur(blurred, sigma);
+            Append(out, blurred);
+        }
+    });
+    CompareLevels("PyramidDown", [&](vector<unsigned char> &out) {
+        Image down;
+        PyramidDown(photo, down);
+        Append(out, down);
+        PyramidDown(rgbF, down);
+        Append(out, down);
+    });
+    CompareLevels("Image::MinMax", [&](vector<unsigned char> &out) {
+        vector<float> min, max;
+        rgbF.MinMax(min, max);
+        Append(out, min.data(), min.size());
+        Append(out, max.data(), max.size());
+    });
+    for (int fixedPoint : {0, 1}) {
+        CompareLevels(fixedPoint ? "Harris response, fixed point" : "Harris response, float", [&](vector<unsigned char> &out) {
+            HarrisDetect detect;
+            HarrisParam param;
+            param.fixedPoint = fixedPoint;
+            HarrisResult result;
+            HarrisWorkspace workspace;
+            detect.FindFeature(photo, param, result, workspace);
+            Append(out, workspace.mResponse);
+        });
+    }
+
+    // the noise has arc-9 corners, the photo those of both arcs. 203 columns leave a tail after
+    // the 16 or 32 pixels of a segment test step.
+    Image noise;
+    FillRandom(noise, 203, 61, 1, ImageType::UINT8);
+    for (int arc : {9, 12}) {
+        CompareLevels(arc == 9 ? "FastDetect, arc 9" : "FastDetect, arc 12", [&](vector<unsigned char> &out) {
+            FastDetect detect;
+            FastResult result;
+            for (const Image *pImage : initializer_list<const Image*>{&noise, &gray}) {
+                for (int nmsSize : {0, 3}) {
+                    FastParam param;
+                    param.arc = arc;
+                    param.nmsSize = nmsSize;
+                    detect.FindFeature(*pImage, param, result);
+                    Append(out, result.mX.data(), result.mX.size());
+                    Append(out, result.mY.data(), result.mY.size());
+                    Append(out, result.mResponse.data(), result.mResponse.size());
+                }
+            }
+        });
+    }
+}
+
+// the unrolled passes of K against the runtime passes over K's taps, at every level
+template <typename K>
+static void CompareStatic(const char *pName)
+{
+    vector<vector<float>> rowsF(K::size);
+    vector<vector<unsigned char>> rowsU8(K::size);
+    vector<vector<unsigned short>> rowsU16(K::size);
+    vector<const float*> ppF(K::size);
+    vector<const unsigned char*> ppU8(K::size);
+    vector<const unsigned short*> ppU16(K::size);
+    for (int k = 0; k < K::size; ++k) {
+        FillRandom(rowsF[k], passCount, -1000.0f, 1000.0f);
+        FillRandom<unsigned char>(rowsU8[k], passCount, 0, 255);
+        FillRandom<unsigned short>(rowsU16[k], passCount, 0, 65535);
+        ppF[k] = rowsF[k].data();
+        ppU8[k] = rowsU8[k].data();
+        ppU16[k] = rowsU16[k].data();
+    }
+    vector<float> padded;
+    FillRandom(padded, (size_t)(passCount + 2*K::center) * 3, -1000.0f, 1000.0f);
+
+    for (int l = 0; l <= (int)SimdLevel::AVX512; ++l) {
+        SetSimdLevel((SimdLevel)l);
+        vector<float> got(passCount * 3), expected(passCount * 3);
+        bool same = true;
+
+        ConvolveColumns<K>(ppF.data(), got.data(), passCount);
+        ConvolveColumns(ppF.data(), K::taps, K::size, expected.data(), passCount);
+        same = same && memcmp(got.data(), expected.data(), passCount * sizeof(float)) == 0;
+        ConvolveColumns<K>(ppU8.data(), got.data(), passCount);
+        ConvolveColumns(ppU8.data(), K::taps, K::size, expected.data(), passCount);
+        same = same && memcmp(got.data(), expected.data(), passCount * sizeof(float)) == 0;
+        ConvolveColumns<K>(ppU16.data(), got.data(), passCount);
+        ConvolveColumns(ppU16.data(), K::taps, K::size, expected.data(), passCount);
+        same = same && memcmp(got.data(), expected.data(), passCount * sizeof(float)) == 0;
+        for (int channel : {1, 3}) {
+            const float *pSrc = padded.data() + K::center * channel;
+            ConvolveRow<K>(pSrc, channel, got.data(), passCount * channel);
+            ConvolveRow(pSrc, channel, K::taps, K::size, K::center, expected.data(), passCount * channel);
+            same = same && memcmp(got.data(), expected.data(), passCount * channel * sizeof(float)) == 0;
+        }
+
+        Check(same, pName, LevelName(GetSimdLevel()));
+    }
+    SetSimdLevel(SimdLevel::AVX512);
+}
+
+static void TestStaticKernels()
+{
+    CompareStatic<SobelSmooth>("StaticKernel SobelSmooth");
+    CompareStatic<ScharrSmooth>("StaticKernel ScharrSmooth");
+    CompareStatic<CentralDifference>("StaticKernel CentralDifference");
+    CompareStatic<Binomial5>("StaticKernel Binomial5");
+}
+
+// every corner of a has one of b at most one pixel away in x and y
+static bool WithinOnePixel(const HarrisResult &a, const HarrisResult &b)
+{
+    for (int i = 0; i < a.Size(); ++i) {
+        bool found = false;
+        for (int j = 0; j < b.Size() && !found; ++j)
+            found = abs(a.mX[i] - b.mX[j]) <= 1 && abs(a.mY[i] - b.mY[j]) <= 1;
+        if (!found)
+            return false;
+    }
+    return true;
+}
+
+// the response within 1% of the float range and the corners within one pixel, as the pipeline documents
+static void TestFixedPoint(const Image &photo)
+{
+    HarrisDetect detect;
+    for (float sigma : {1.0f, 2.0f, 4.0f}) {
+        HarrisParam param;
+        param.sigma = sigma;
+        HarrisResult result;
+        HarrisWorkspace floats, fixed;
+        detect.FindFeature(photo, param, result, floats);
+        param.fixedPoint = 1;
+        detect.FindFeature(photo, param, result, fixed);
+
+        vector<float> min, max;
+        floats.mResponse.MinMax(min, max);
+        float maxError = 0.0f;
+        for (int y = 0; y < photo.GetHeight(); ++y) {
+            const float *pFloat = floats.mResponse.GetRow<float>(y);
+            const float *pFixed = fixed.mResponse.GetRow<float>(y);
+            for (int x = 0; x < photo.GetWidth(); ++x)
+                maxError = std::max(maxError, fabs(pFloat[x] - pFixed[x]));
+        }
+        char detail[64];
+        snprintf(detail, sizeof(detail), "sigma %g: %.2f%% of the range", sigma, 100.0f * maxError / (max[0] - min[0]));
+        Check(maxError <= 0.01f * (max[0] - min[0]), "fixed point response within 1%", detail);
+    }
+
+    for (float sigma : {1.0f, 2.0f, 4.0f}) {
+        for (int thd : {100, 150, 200}) {
+            HarrisParam param;
+            param.sigma = sigma;
+            param.thd = thd;
+            param.nmsSize = 5;
+            HarrisResult floats, fixed;
+            detect.FindFeature(photo, param, floats);
+            param.fixedPoint = 1;
+            detect.FindFeature(photo, param, fixed);
+
+            char detail[64];
+            snprintf(detail, sizeof(detail), "sigma %g thd %d: %d and %d corners", sigma, thd, floats.Size(), fixed.Size());
+            Check(floats.Size() > 0 && WithinOnePixel(floats, fixed) && WithinOnePixel(fixed, floats),
+                  "fixed point corners within 1 px", detail);
+        }
+    }
+}
+
+static bool SameCorners(const HarrisResult &a, const HarrisResult &b)
+{
+    return a.mX == b.mX && a.mY == b.mY && a.mResponse == b.mResponse;
+}
+
+// pushes image row by row, a corner must not be reported before the row it lies on
+static void CompareStream(const Image &image, const HarrisParam &param, const char *pName)
+{
+    HarrisDetect detect;
+    HarrisResult expected, got;
+    detect.FindFeature(image, param, expected);
+
+    HarrisStream stream;
+    bool ok = stream.Begin(image.GetWidth(), image.GetHeight(), image.GetChannel(), param) == CVError::NOERROR;
+    for (int y = 0; y < image.GetHeight() && ok; ++y) {
+        int before = got.Size();
+        ok = stream.PushRow(image.GetRow<unsigned char>(y), got) == CVError::NOERROR;
+        for (int i = before; i < got.Size(); ++i)
+            ok = ok && got.mY[i] <= y;
+    }
+
+    char detail[96];
+    snprintf(detail, sizeof(detail), "%dx%dx%d sigma %g nms %d: %d corners", image.GetWidth(), image.GetHeight(),
+             image.GetChannel(), param.sigma, param.nmsSize, expected.Size());
+    Check(ok && SameCorners(expected, got), pName, detail);
+}
+
+static void TestStream(const Image &photo, const char *pPhotoName)
+{
+    Image gray;
+    photo.RGB2Gray(gray);
+    for (int nmsSize : {0, 3, 5}) {
+        for (float sigma : {1.0f, 2.0f}) {
+            HarrisParam param;
+            param.sigma = sigma;
+            param.nmsSize = nmsSize;
+            param.rawThd = 1e9f;
+            CompareStream(photo, param, "HarrisStream rows");
+            CompareStream(gray, param, "HarrisStream rows");
+        }
+    }
+
+    // heights and widths below the kernel size
+    for (int height : {1, 2, 5, 13}) {
+        for (int width : {1, 4, 33}) {
+            Image image;
+            image.Allocate(width, height, 3, ImageType::UINT8);
+            uniform_int_distribution<int> dist(0, 3);
+            for (int y = 0; y < height; ++y)
+                for (int x = 0; x < 3 * width; ++x)
+                    image.GetRow<unsigned char>(y)[x] = (unsigned char)(dist(rng) * 60);
+            HarrisParam param;
+            param.nmsSize = 3;
+            param.rawThd = 1e6f;
+            CompareStream(image, param, "HarrisStream small image");
+        }
+    }
+
+    // the decoder thread hands over blocks of 7 rows
+    HarrisParam param;
+    param.nmsSize = 3;
+    param.rawThd = 1e9f;
+    HarrisDetect detect;
+    HarrisResult expected, got;
+    detect.FindFeature(photo, param, expected);
+    HarrisStream stream;
+    stream.mBlockRows = 7;
+    stream.mQueueSize = 2;
+    CVError status = stream.FindFeature(pPhotoName, param, got);
+    Check(status == CVError::NOERROR && SameCorners(expected, got), "HarrisStream JPEG file");
+}
+
+static vector<unsigned char> Bytes(const Image &image)
+{
+    vector<unsigned char> bytes;
+    Append(bytes, image);
+    return bytes;
+}
+
+static const void* ConstData(const Image &image)
+{
+    return image.GetData();
+}
+
+static void TestCopyOnWrite()
+{
+    Image a;
+    FillRandom(a, 64, 48, 3, ImageType::UINT8);
+    vector<unsigned char> original = Bytes(a);
+
+    Image b = a;
+    Check(a.IsShared() && b.IsShared() && ConstData(a) == ConstData(b), "COW copy shares the buffer");
+
+    // every way of writing a copy leaves the original alone
+    float value = (a.GetPixel(5, 7, 1) < 128.0f) ? 255.0f : 0.0f;
+    Image c = a;
+    c.SetPixel(5, 7, 1, value);
+    Check(Bytes(a) == original && c.GetPixel(5, 7, 1) == value && !c.IsShared(), "COW SetPixel on a copy");
+
+    Image d = a;
+    d.DrawLine(0, 0, 63, 47, 255.0f, 0.0f, 0.0f);
+    d.DrawPoint(30, 20, 0.0f, 255.0f, 0.0f, 5);
+    Check(Bytes(a) == original && Bytes(d) != original, "COW Draw on a copy");
+
+    Image e = a;
+    unsigned char *pRow = e.GetRow<unsigned char>(9);
+    pRow[4] = (unsigned char)(255 - pRow[4]);
+    Check(Bytes(a) == original && Bytes(e) != original, "COW GetRow write on a copy");
+    Check(b.IsShared() && ConstData(a) == ConstData(b), "COW untouched copy still shared");
+
+    // a buffer that had a view taken is not shared again, the view keeps writing into it
+    Image p;
+    FillRandom(p, 32, 32, 1, ImageType::UINT8);
+    Image view;
+    p.GetView(view, 8, 8, 8, 8);
+    Image q = p;
+    vector<unsigned char> copied = Bytes(q);
+    view.SetPixel(0, 0, 0, 255.0f - p.GetPixel(8, 8, 0));
+    Check(!p.IsShared() && !q.IsShared() && ConstData(p) != ConstData(q), "COW view pins the buffer");
+    Check(p.GetPixel(8, 8, 0) == view.GetPixel(0, 0, 0) && Bytes(q) == copied, "COW view writes its parent only");
+
+    // a const view of a shared image is shared itself until it detaches or allocates
+    Image s;
+    FillRandom(s, 32, 32, 1, ImageType::UINT8);
+    Image s2 = s;
+    original = Bytes(s);
+    const Image &cs = s;
+    Image cv;
+    cs.GetView(cv, 4, 4, 16, 16);
+    Check(cv.IsShared() && cv.IsView(), "COW const view of a shared image is shared");
+    Image window;
+    cs.GetView(window, 4, 4, 16, 16);
+    Image expected = window;
+    Check(cv.Detach() == CVError::NOERROR && !cv.IsView() && !cv.IsShared() && Bytes(cv) == Bytes(expected),
+          "COW const view Detach copies the window");
+    cv.SetPixel(0, 0, 0, 255.0f - cv.GetPixel(0, 0, 0));
+    Image cv2;
+    cs.GetView(cv2, 4, 4, 16, 16);
+    Check(cv2.Allocate(16, 16, 1, ImageType::UINT8) == CVError::NOERROR && !cv2.IsView() && !cv2.IsShared(),
+          "COW const view Allocate takes a buffer");
+    memset(cv2.GetRow<unsigned char>(0), 0, 16);
+    Check(Bytes(s) == original && Bytes(s2) == original, "COW const view writes leave the shared image alone");
+}
+
+int main(int argc, char **argv)
+{
+    const char *pPhotoName = (argc > 1) ? argv[1] : "../images/chessboard.jpg";
+    Image photo;
+    if (photo.ReadJpegImage(pPhotoName) != CVError::NOERROR) {
+        printf("usage: %s [image.jpg]\n", argv[0]);
+        return 1;
+    }
+
+    TestSimdPasses();
+    TestFixedPasses();
+    TestSimdImages(photo);
+    TestStaticKernels();
+    TestFixedPoint(photo);
+    TestStream(photo, pPhotoName);
+    TestCopyOnWrite();
+
+    printf("%d failed\n", failures);
+    return failures;
+}